@@ -3,6 +3,8 @@
 #include "benchmark.hh"
 #include "cache.hh"
 #include "compiler.hh"
+#include "diagnostics.hh"
+#include "file_watch.hh"
 #include "scan.hh"
 #include "tests.hh"
 
@@ -11,48 +13,71 @@
 #define CACHE_PATH config.root_dir + "/build/.cache"
 #define LOG_PATH config.root_dir + "/build/logs/log.out"
 
-void build_procedure(const Config &config, bool init_only = false) {
-    int modifications = 0;
+// true once a build succeeded: the tables in containers.hh then describe
+// the tree as built, and watch mode can update them from events alone.
+bool build_state_valid = false;
+
+void load_source_deps(const Config &config, SourceFile &src) {
     try {
-        init_working_dir(config);
-        if (init_only)
-            return;
-        scan(config);
-    } catch (const std::exception &e) {
-        Logger::debug("failed at stage: " + std::string(e.what()));
+        fs::path dep = depfile_path(src, config.track_external_headers);
+        src.cmd_hash = command_hash(config, src);
+        // include dirs take part in the command, so a changed command
+        // may also resolve includes differently.
+        if (need_regen_deps(path_pool.str(src.id), dep) ||
+            command_changed(src)) {
+            generate_deps(LOG_PATH, config, src);
+        }
+        load_compiler_deps(config, src);
+    } catch (const char *msg) {
+        Logger::printLogfile(LOG_PATH, config);
+        Logger::debug("failed at stage: " + std::string(msg));
         throw;
-    } catch (int &i) {
-        // dry run catch
-        throw i;
     }
+}
 
-    load_cache(CACHE_PATH);
-
-    for (auto &[_, src] : sources) {
-        try {
-            fs::path dep = depfile_path(src.path);
-            if (need_regen_deps(src.path, dep)) {
-                generate_deps(LOG_PATH, config, src);
-            }
-            load_compiler_deps(src);
-        } catch (const char *msg) {
-            Logger::printLogfile(LOG_PATH, config);
-            Logger::debug("failed at stage: " + std::string(msg));
-            throw;
-        }
+// watch mode's changed_during_build(): what the watcher saw since the last
+// look. the events stay queued for the next file_watcher() call.
+bool watched_changes(std::vector<PathId> &changed) {
+    std::vector<WatchEvent> fresh;
+    if (!poll_watcher(fresh))
+        return false;
+    changed.clear();
+    for (const auto &ev : fresh) {
+        PathId id = path_pool.find(normalize_path(ev.path));
+        if (id != NO_PATH)
+            changed.push_back(id);
     }
+    return true;
+}
 
-    mark_modified(config);
-
+void compile_and_finish(const Config &config) {
+    int modifications = 0;
+    changed_during_build = config.watch_mode ? watched_changes : nullptr;
     try {
         modifications = compile_and_link(config);
     } catch (const char *msg) {
+        discard_speculations();
         Logger::printLogfile(LOG_PATH, config);
         Logger::debug("failed at stage: " + std::string(msg));
         throw;
     }
+    // speculations of sources that turned out unmodified
+    discard_speculations();
 
+    if (build_cancelled) {
+        // keep what finished, the next build starts from there
+        save_cache(CACHE_PATH);
+        remember_build();
+        build_state_valid = true;
+        Logger::warningLog("inputs changed during the build, restarting");
+        std::cout.flush();
+        return;
+    }
+    for (auto &[_, src] : sources)
+        src.modified = false;
     save_cache(CACHE_PATH);
+    remember_build();
+    build_state_valid = true;
     if (modifications != 0)
         Logger::successLog("build target: " + config.executable_name);
     std::cout.flush();
@@ -72,4 +97,119 @@ void build_procedure(const Config &config, bool init_only = false) {
         }
     }
 }
+
+void build_procedure(const Config &config, bool init_only = false) {
+    build_state_valid = false;
+    try {
+        init_working_dir(config);
+        if (init_only)
+            return;
+        scan(config);
+        if (config.warnings_summary) {
+            print_warnings_summary(config);
+            return;
+        }
+    } catch (const std::exception &e) {
+        Logger::debug("failed at stage: " + std::string(e.what()));
+        throw;
+    } catch (int &i) {
+        // dry run catch
+        throw i;
+    }
+
+    load_cache(CACHE_PATH);
+    load_toolchain(config);
+
+    include_edges.clear();
+    include_users.clear();
+    // always built: watch mode and the daemon both follow it, and a
+    // daemon's requests don't carry watch_mode
+    for (auto &[_, src] : sources) {
+        load_source_deps(config, src);
+        link_include_users(src);
+    }
+
+    mark_modified(config);
+    compile_and_finish(config);
+}
+
+// marks the sources that include `id` as modified
+void mark_include_users(PathId id) {
+    const std::vector<PathId> *users = include_users.find(id);
+    if (!users)
+        return;
+    for (PathId user : *users) {
+        SourceFile *src = sources.find(user);
+        // the list only grows, check the source still includes it
+        if (!src || src->modified)
+            continue;
+        for (PathId inc : includes_of(*src)) {
+            if (inc == id) {
+                src->modified = true;
+                break;
+            }
+        }
+    }
+}
+
+// watch mode: rebuild from the paths the watcher reported. sources and
+// headers that weren't touched keep their hashes, dependencies and old
+// records from the previous build; only a change to the set of files, or
+// a watcher that misses directories, falls back to a full scan.
+void incremental_build(const Config &config,
+                       const std::vector<WatchEvent> &events) {
+    if (!build_state_valid || !watching() || structural_change(events)) {
+        build_procedure(config);
+        return;
+    }
+    build_state_valid = false;
+    load_toolchain(config);
+    if (config.use_git_index)
+        load_git_index(config);
+
+    FlatMap<bool> changed;
+    for (const auto &ev : events) {
+        PathId id = path_pool.find(normalize_path(ev.path));
+        if (id != NO_PATH)
+            changed[id] = true;
+    }
+
+    for (auto &[id, _] : changed) {
+        if (SourceFile *src = sources.find(id)) {
+            // the new row goes to the end of the graph, the old one is
+            // left unused until the next full build
+            load_source_deps(config, *src);
+            link_include_users(*src);
+            hash_includes(config, *src);
+            hash_source(config, *src);
+            const uint64_t *old = old_hashes.find(id);
+            if (!old || *old != src->hash || command_changed(*src)) {
+                Logger::warningLog("file modified: " + source_path(*src));
+                src->modified = true;
+            }
+            continue;
+        }
+
+        HeaderFile *hf = headers.find(id);
+        if (!hf) {
+            // included, but not a header scan() tracks (.inl, .def, ...).
+            // there is no recorded hash to compare, the write is the change
+            if (include_users.count(id)) {
+                Logger::warningLog("file modified: " + relative_path(id));
+                mark_include_users(id);
+            }
+            continue;
+        }
+        hf->hashed = false;
+        ensure_hashed(config, id, *hf);
+        // without an old record it wasn't reachable from any source
+        const uint64_t *old = old_hashes.find(id);
+        if (!old || *old == hf->hash)
+            continue;
+        Logger::warningLog("file modified: " + relative_path(id));
+        mark_include_users(id);
+    }
+
+    compile_and_finish(config);
+}
 #endif
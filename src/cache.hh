@@ -6,6 +6,7 @@
 #include "logger.hh"
 #include <filesystem>
 #include <fstream>
+#include <sstream>
 #include <string>
 namespace fs = std::filesystem;
 
@@ -20,18 +21,81 @@ void cleanTemp(const fs::path &tempPath) {
     }
 }
 
+// headers included by a source that still has to be rebuilt, after a
+// cancelled build. their new hashes are only recorded once it has been,
+// until then they keep their old record, as do the sources themselves.
+FlatMap<bool> unsettled_headers() {
+    FlatMap<bool> unsettled;
+    for (auto &[_, src] : sources)
+        if (src.modified)
+            for (PathId inc : includes_of(src))
+                unsettled[inc] = true;
+    return unsettled;
+}
+
+// the same records for the next watch-mode build, without the disk
+void remember_build() {
+    FlatMap<bool> unsettled = unsettled_headers();
+    bool settled = true;
+    for (auto &[id, src] : sources) {
+        if (src.modified) {
+            settled = false;
+            continue;
+        }
+        old_hashes[id] = src.hash;
+        old_cmd_hashes[id] = src.cmd_hash;
+        old_obj_hashes[id] = src.obj_hash;
+    }
+    for (auto &[id, hf] : headers)
+        if (hf.hashed && !unsettled.count(id))
+            old_hashes[id] = hf.hash;
+    if (settled)
+        for (auto &[id, h] : external_hashes)
+            old_hashes[id] = h;
+}
+
 void save_cache(const fs::path &cachePath) {
     fs::path tempPath = cachePath;
     tempPath += ".tmp";
     std::ofstream out(tempPath);
     ENABLE_EXCEPTIONS(out);
 
+    FlatMap<bool> unsettled = unsettled_headers();
+    bool settled = true;
     try {
-        for (auto &[_, s] : sources)
-            out << normalize_path(s.path) << " " << s.hash << "\n";
+        for (auto &[id, s] : sources) {
+            if (!s.modified) {
+                out << path_pool.view(id) << " " << s.hash << " "
+                    << s.cmd_hash << " " << s.obj_hash << "\n";
+                continue;
+            }
+            settled = false;
+            const uint64_t *h = old_hashes.find(id);
+            const uint64_t *cmd = old_cmd_hashes.find(id);
+            const uint64_t *obj = old_obj_hashes.find(id);
+            if (h && cmd && obj)
+                out << path_pool.view(id) << " " << *h << " " << *cmd << " "
+                    << *obj << "\n";
+        }
+
+        for (auto &[id, h] : headers) {
+            if (h.hashed && !unsettled.count(id)) {
+                out << path_pool.view(id) << " " << h.hash << "\n";
+                continue;
+            }
+            // not reachable from any source this time, keep its old record
+            if (const uint64_t *oh = old_hashes.find(id))
+                out << path_pool.view(id) << " " << *oh << "\n";
+        }
 
-        for (auto &[_, h] : headers)
-            out << normalize_path(h.path) << " " << h.hash << "\n";
+        if (settled)
+            for (auto &[id, h] : external_hashes)
+                out << path_pool.view(id) << " " << h << "\n";
+        // groups not in use this time keep their old record
+        for (auto &[id, h] : old_hashes)
+            if (path_pool.view(id)[0] == '@' &&
+                (!settled || !external_hashes.count(id)))
+                out << path_pool.view(id) << " " << h << "\n";
 
         out.flush();
         out.close();
@@ -54,7 +118,9 @@ void save_cache(const fs::path &cachePath) {
     }
 
     for (const auto &inc : headers) {
-        Logger::debug("cached header: " + readable_path(inc.second.path) +
+        if (!inc.second.hashed)
+            continue;
+        Logger::debug("cached header: " + relative_path(inc.first) +
                       " | hash: " + std::to_string(inc.second.hash));
     }
 }
@@ -67,12 +133,22 @@ void load_cache(const fs::path &cachePath) {
 
     std::ifstream in(cachePath);
     ENABLE_EXCEPTIONS(in);
-    std::string path;
-    uint64_t h;
+    std::string line, path;
+    uint64_t h, cmd, obj;
 
     try {
-        while (in >> path >> h) {
-            old_hashes[path] = h;
+        // "<path> <hash>" for headers,
+        // "<path> <hash> <cmd_hash> <obj_hash>" for sources
+        while (std::getline(in, line)) {
+            std::istringstream iss(line);
+            if (!(iss >> path >> h))
+                continue;
+            PathId id = path_pool.intern(path);
+            old_hashes[id] = h;
+            if (iss >> cmd)
+                old_cmd_hashes[id] = cmd;
+            if (iss >> obj)
+                old_obj_hashes[id] = obj;
         }
     } catch (const std::ios_base::failure &e) {
         Logger::failLog("load_cache(): failed to read cache at \"" +
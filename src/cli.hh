@@ -10,8 +10,10 @@ Usage: mkc [options]
 
 Config:
   init                    Create example config and initialize current directory
+  daemon                  Keep the build state in memory and serve mkc runs
   --config <file>         Load configuration from file
   --watch                 Watch project directory for changes and rebuild.
+  --speculative           With --watch, start compiling saved files early
   --run                   Run the executable after compilation
   --exclude <file>        Exclude directory or specific file
   --exclude-fmt           Exclude a file extension (eg: .c)
@@ -19,6 +21,7 @@ Config:
   -o, --output <name>     Specify output executable name
   -j, --jobs <num>        Number of parallel compilation jobs
   -c, --clean             Rebuild all files (same as --clean)
+  --retry-failed          Recompile sources whose last failure is cached
 
 Compiler Options:
   --compiler <compiler>   Specify compiler (default: g++)
@@ -29,6 +32,12 @@ Compiler Options:
   -l <lib>                Link library
   -L <dir>                Add library search path
   --unity <name>          Set unity build to true, auto-generate translation unit
+  --unity-chunks <n>      Split the unity build into n parallel chunks
+  --unity-chunk-size <b>  Split the unity build into chunks of at most b bytes
+  --unity-adaptive        Compile files edited since the last clean build alone
+  --token-headers         Ignore comments and formatting when hashing headers
+  --track-external        Rebuild when system or third-party headers change
+  --git-index             Reuse git's blob ids for unmodified tracked files
   --link-flags            Add arbitrary flags for the linker
   --shared                Use when creating a shared object
   --clean                 Rebuild all files
@@ -42,6 +51,7 @@ Log Options:
   --benchmark             Print time elapsed while building
   --dry-run               Scan, print sources & headers, and exit
   --dry-run-toml          Scan and print sources in toml array format
+  --warnings-summary      Print cached compiler warnings without compiling
   --benchmark-msg         Note to be added beside benchmark in the logfile
   --immediate             Force flushing all logs
 
@@ -49,6 +59,7 @@ Examples:
   mkc --clean --debug           # Clean debug build
   mkc -j 4 -O 3                  # Parallel release build with -O3
   mkc --watch --run             # Watch, rebuild and run on changes
+  mkc daemon &                  # Later mkc runs are answered from memory
 )";
 }
 
@@ -67,6 +78,10 @@ Config parse_cli_args(int argc, char *argv[]) {
             throw 1;
         }
 
+        else if (arg == "daemon") {
+            config.daemon_mode = true;
+        }
+
         else if (arg == "-v" || arg == "--verbose") {
             config.log_verbosity = Verbosity::verbose;
         } else if (arg == "-d" || arg == "--debug-log") {
@@ -77,6 +92,8 @@ Config parse_cli_args(int argc, char *argv[]) {
 
         else if (arg == "-c" || arg == "--clean") {
             config.rebuild_all = true;
+        } else if (arg == "--retry-failed") {
+            config.retry_failed = true;
         } else if (arg == "-o" || arg == "--output") {
             if (i + 1 < argc) {
                 config.executable_name = argv[++i];
@@ -156,6 +173,21 @@ Config parse_cli_args(int argc, char *argv[]) {
             } else {
                 throw std::runtime_error("--unity-t requires an argument");
             }
+        } else if (arg == "--unity-chunks") {
+            if (i + 1 < argc) {
+                config.unity_chunk_count = std::stoi(argv[++i]);
+            } else {
+                throw std::runtime_error("--unity-chunks requires an argument");
+            }
+        } else if (arg == "--unity-adaptive") {
+            config.unity_adaptive = true;
+        } else if (arg == "--unity-chunk-size") {
+            if (i + 1 < argc) {
+                config.unity_chunk_bytes = std::stoull(argv[++i]);
+            } else {
+                throw std::runtime_error(
+                    "--unity-chunk-size requires an argument");
+            }
         } else if (arg == "-L") {
             if (i + 1 < argc) {
                 config.link_flags.push_back("-L" + std::string(argv[++i]));
@@ -172,6 +204,8 @@ Config parse_cli_args(int argc, char *argv[]) {
             }
         } else if (arg == "--watch") {
             config.watch_mode = true;
+        } else if (arg == "--speculative") {
+            config.speculative = true;
         } else if (arg == "--run") {
             config.run_mode = true;
         } else if (arg == "--immediate") {
@@ -183,8 +217,16 @@ Config parse_cli_args(int argc, char *argv[]) {
         } else if (arg == "--dry-run-toml") {
             config.dry_run = true;
             config.dry_run_toml = true;
+        } else if (arg == "--warnings-summary") {
+            config.warnings_summary = true;
         } else if (arg == "--benchmark") {
             config.benchmark = true;
+        } else if (arg == "--track-external") {
+            config.track_external_headers = true;
+        } else if (arg == "--token-headers") {
+            config.token_header_hash = true;
+        } else if (arg == "--git-index") {
+            config.use_git_index = true;
         } else if (arg == "--shared") {
             config.make_shared = true;
         } else if (arg == "--benchmark-msg") {
@@ -0,0 +1,65 @@
+#ifndef COMMAND_H_
+#define COMMAND_H_
+#include "config.hh"
+#include "containers.hh"
+#include "helpers.hh"
+#include "toolchain.hh"
+#include <string>
+
+// the exact command used to compile `src`, without output redirection.
+// mark_modified() fingerprints it, so anything that changes the produced
+// object has to go through here.
+std::string compile_command(const Config &conf, const SourceFile &src,
+                            const fs::path &object) {
+    std::string cmd = conf.compiler;
+    cmd += " -c " + source_path(src);
+    cmd += " -o " + object.string();
+
+    for (const auto &inc : conf.include_dirs)
+        cmd += " -I" + inc.string();
+    for (const auto &flag : conf.compile_flags)
+        cmd += " " + flag;
+    return cmd;
+}
+
+std::string compile_command(const Config &conf, const SourceFile &src) {
+    return compile_command(conf, src, object_path(src));
+}
+
+// the command alone misses what the compiler binary itself brings in, so
+// the toolchain identity is folded in as well.
+uint64_t command_hash(const Config &conf, const SourceFile &src) {
+    uint64_t h = hash_string(compile_command(conf, src));
+    h ^= toolchain.identity;
+    h *= 1099511628211ULL;
+    return h;
+}
+
+// everything a compile of `src` depends on: its contents, the contents of the
+// headers it includes and the exact command (toolchain included). used to key
+// cached failures and to validate speculative compiles.
+template <typename HeaderHash>
+uint64_t input_fingerprint(const SourceFile &src, uint64_t src_hash,
+                           HeaderHash header_hash) {
+    uint64_t h = 1469598103934665603ULL;
+    auto mix = [&](uint64_t v) {
+        h ^= v;
+        h *= 1099511628211ULL;
+    };
+
+    mix(src_hash);
+    for (PathId inc : includes_of(src)) {
+        if (const HeaderFile *hf = headers.find(inc))
+            mix(header_hash(inc, *hf));
+    }
+    mix(src.cmd_hash);
+    return h;
+}
+
+// with the hashes of the current build
+uint64_t input_fingerprint(const SourceFile &src) {
+    return input_fingerprint(
+        src, src.hash, [](PathId, const HeaderFile &hf) { return hf.hash; });
+}
+
+#endif
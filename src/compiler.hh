@@ -1,12 +1,46 @@
 #ifndef COMPILER_H_
 #define COMPILER_H_
 #include "compiler_unity.hh"
+#include "diagnostics.hh"
+#include "process.hh"
+#include "speculative.hh"
 #include "static_lib.hh"
 #include <atomic>
 #include <future>
+#include <memory>
 #include <mutex>
 #include <thread>
 
+// set in watch mode: returns true if relevant files changed since the last
+// call, and fills `changed` with the ones that are known. polled while
+// compiling and linking so that stale work can be dropped.
+bool (*changed_during_build)(std::vector<PathId> &changed) = nullptr;
+// the last compile_and_link() stopped early because its inputs changed
+bool build_cancelled = false;
+
+// true if `src` reads any of `changed`
+bool inputs_changed(const SourceFile &src, const FlatMap<bool> &changed) {
+    if (changed.count(src.id))
+        return true;
+    for (PathId inc : includes_of(src))
+        if (changed.count(inc))
+            return true;
+    return false;
+}
+
+// the object hash recorded with the cached build of `src`. it is what a
+// recompile gets compared against, and what the link fingerprint uses for
+// objects that are reused.
+void load_object_hash(SourceFile &src) {
+    if (src.obj_hash != 0)
+        return;
+    fs::path object = object_path(src);
+    if (const uint64_t *old = old_obj_hashes.find(src.id))
+        src.obj_hash = *old;
+    else if (fs::exists(object))
+        src.obj_hash = hash_file(object);
+}
+
 // NOTE TO SELF: compile flags MUST be the same as the ones we pass to dep_gen
 // func.
 bool compile_objects(const Config &conf, int &modified) {
@@ -19,11 +53,39 @@ bool compile_objects(const Config &conf, int &modified) {
     }
 
     std::vector<SourceFile *> jobs;
+    std::vector<SourceFile *> speculated;
     for (auto &[_, src] : sources) {
+        load_object_hash(src);
         if (src.modified || conf.rebuild_all) {
-            jobs.push_back(&src);
+            if (!conf.rebuild_all && has_speculation(src))
+                speculated.push_back(&src);
+            else
+                jobs.push_back(&src);
+        } else {
+            replay_diagnostics(source_path(src), object_path(src));
         }
     }
+    // speculative compiles keep running next to the regular ones and are
+    // only waited for afterwards. the ones that can't be adopted compile
+    // normally.
+    if (!compile_jobs(conf, jobs, modified))
+        return false;
+    if (build_cancelled)
+        return true;
+    std::vector<SourceFile *> rest;
+    for (SourceFile *src : speculated) {
+        if (adopt_speculation(*src))
+            ++modified;
+        else
+            rest.push_back(src);
+    }
+    return compile_jobs(conf, rest, modified);
+}
+
+// compiles `jobs` in parallel, at most conf.parallel_jobs at a time, and
+// adds the number that compiled to `modified`.
+bool compile_jobs(const Config &conf, const std::vector<SourceFile *> &jobs,
+                  int &modified) {
     if (jobs.empty())
         return true;
 
@@ -36,74 +98,152 @@ bool compile_objects(const Config &conf, int &modified) {
     std::atomic<int> modified_atomic{0};
     std::mutex log_mutex;
     bool failed = false;
-    auto compile_one = [&](SourceFile *src) -> bool {
-        std::string cmd = conf.compiler;
-        cmd += " -c " + src->path.string();
-        cmd += " -o " + src->object.string();
-
-        for (const auto &inc : conf.include_dirs)
-            cmd += " -I" + inc.string();
-        for (const auto &flag : conf.compile_flags)
-            cmd += " " + flag;
-
+    auto compile_one = [&](SourceFile *src,
+                           std::shared_ptr<std::atomic<bool>> cancel) -> bool {
+        fs::path object = object_path(*src);
+        std::string name = source_path(*src);
+        std::string cmd = compile_command(conf, *src, object);
         std::string cmd_no_log = cmd;
         // TODO: as a matter of design choice here.. taking the compiler output
         // into the log file then back out of the log file
         // takes away the colors of the compiler output, which isn't
         // particularly nice.
         std::string logfile =
-            "build/logs/log_" + src->object.filename().stem().string() + ".out";
-        cmd += " >> " + logfile + " 2>&1";
-        if (std::system(cmd.c_str()) != 0)
+            "build/logs/log_" + object.stem().string() + ".out";
+        cmd += " > " + logfile + " 2>&1";
+
+        uint64_t fingerprint = input_fingerprint(*src);
+        std::string diags;
+        if (!conf.retry_failed &&
+            cached_failure(object, fingerprint, diags)) {
+            std::lock_guard<std::mutex> lock(log_mutex);
+            Logger::failLog("cached failure (inputs unchanged): " + name);
+            Logger::printDiagnostics(diags);
             return false;
+        }
+
+        std::function<bool()> interrupted;
+        if (changed_during_build)
+            interrupted = [&] { return cancel->load(); };
+        int rc = run_command(cmd, interrupted);
+        if (rc == COMMAND_CANCELLED) {
+            // stays modified, the restarted build picks it up
+            std::lock_guard<std::mutex> lock(log_mutex);
+            Logger::warningLog("cancelled: " + name);
+            return true;
+        }
+        if (rc != 0) {
+            diags = read_text_file(logfile);
+            store_failure(object, fingerprint, diags);
+            std::lock_guard<std::mutex> lock(log_mutex);
+            Logger::failLog("failed to compile: " + name);
+            Logger::printDiagnostics(diags);
+            return false;
+        }
+        clear_failure(object);
+        diags = store_diagnostics(object, logfile);
+        uint64_t previous = src->obj_hash;
+        src->obj_hash = hash_file(object);
+        src->modified = false;
         {
             std::lock_guard<std::mutex> lock(log_mutex);
-            Logger::successLog("compiled: " + readable_path(src->path));
+            Logger::successLog("compiled: " + name);
+            Logger::printDiagnostics(diags);
             Logger::infoLog("compile command was: " + cmd_no_log);
+            if (previous != 0 && previous == src->obj_hash)
+                Logger::debug("object unchanged: " + object.string());
         }
         modified_atomic.fetch_add(1, std::memory_order_relaxed);
         return true;
     };
 
-    std::vector<std::future<bool>> running;
+    struct Running {
+        SourceFile *src;
+        std::shared_ptr<std::atomic<bool>> cancel;
+        std::future<bool> result;
+    };
+    std::vector<Running> running;
     running.reserve(max_jobs);
 
-    for (SourceFile *src : jobs) {
-        while (running.size() >= max_jobs) {
+    // watch mode: once the inputs moved on, nothing new is started and the
+    // compiles reading changed files are killed. the others finish, their
+    // objects are still good.
+    auto check_changes = [&]() {
+        std::vector<PathId> changed_ids;
+        if (!changed_during_build || !changed_during_build(changed_ids))
+            return;
+        build_cancelled = true;
+        FlatMap<bool> changed;
+        for (PathId id : changed_ids)
+            changed[id] = true;
+        for (auto &job : running)
+            if (inputs_changed(*job.src, changed))
+                job.cancel->store(true);
+    };
+
+    auto reap = [&](bool all) {
+        while (!running.empty() && (all || running.size() >= max_jobs)) {
             for (auto it = running.begin(); it != running.end();) {
-                if (it->wait_for(std::chrono::seconds(0)) ==
+                if (it->result.wait_for(std::chrono::milliseconds(1)) ==
                     std::future_status::ready) {
-                    if (!it->get())
+                    if (!it->result.get())
                         failed = true;
                     it = running.erase(it);
                 } else {
                     ++it;
                 }
             }
+            check_changes();
         }
-        if (!failed)
-            running.emplace_back(
-                std::async(std::launch::async, compile_one, src));
-    }
+    };
 
-    for (auto &f : running) {
-        if (!f.get())
-            failed = true;
+    for (SourceFile *src : jobs) {
+        reap(false);
+        check_changes();
+        if (failed || build_cancelled)
+            break;
+        auto cancel = std::make_shared<std::atomic<bool>>(false);
+        running.push_back({src, cancel,
+                           std::async(std::launch::async, compile_one, src,
+                                      cancel)});
     }
+    reap(true);
 
-    modified = modified_atomic.load();
+    modified += modified_atomic.load();
     return !failed;
 }
 
-bool link_executable(const Config &conf) {
+std::string link_output(const Config &conf) {
+    if (conf.make_shared)
+        return "build/lib" + conf.executable_name + ".so";
+    return "build/" + conf.executable_name;
+}
+
+// objects and archives, in the order they are passed to the linker.
+std::vector<fs::path> link_inputs(const Config &conf) {
+    std::vector<fs::path> inputs;
+    if (conf.unity_b) {
+        for (auto &obj : unity_objects(conf))
+            inputs.push_back(obj);
+    } else {
+        for (const auto &[_, src] : sources)
+            inputs.push_back(object_path(src));
+    }
+    for (const auto &lib : conf.static_libs)
+        inputs.push_back(fs::path("build/lib") / lib.name / lib.archive);
+    return inputs;
+}
+
+std::string link_command(const Config &conf) {
     std::string cmd = conf.compiler;
     if (conf.make_shared)
         cmd += " -shared";
     if (conf.unity_b) {
-        cmd += " " + conf.unity_obj.string();
+        for (auto &obj : unity_objects(conf))
+            cmd += " " + obj.string();
     } else {
         for (const auto &[_, src] : sources) {
-            cmd += " " + src.object.string();
+            cmd += " " + object_path(src).string();
         }
     }
 
@@ -112,24 +252,103 @@ bool link_executable(const Config &conf) {
     }
     for (const auto &lib : conf.static_libs)
         cmd += " build/lib/" + lib.name.string() + "/" + lib.archive.string();
-    if (conf.make_shared) {
-        cmd += " -o build/lib" + conf.executable_name + ".so";
-    } else {
-        cmd += " -o build/" + conf.executable_name;
+    cmd += " -o " + link_output(conf);
+    return cmd;
+}
+
+fs::path link_cache_path() { return fs::path("build/.link"); }
+
+// everything the last link consumed: the command (inputs, flags, output),
+// the toolchain, the content hash of every object and the stat signature of
+// the unity object and archives. objects are compared by content so that a
+// recompile producing identical bytes doesn't force a relink.
+uint64_t hash_link(const Config &conf) {
+    uint64_t h = hash_string(link_command(conf));
+    auto mix = [&](uint64_t v) {
+        h ^= v;
+        h *= 1099511628211ULL;
+    };
+    mix(toolchain.identity);
+    if (!conf.unity_b) {
+        for (auto &[_, src] : sources) {
+            load_object_hash(src);
+            if (src.obj_hash == 0)
+                return 0;
+            mix(src.obj_hash);
+        }
+    }
+    for (const auto &input : link_inputs(conf)) {
+        if (!conf.unity_b && input.parent_path() == "build/obj")
+            continue;
+        uint64_t size = 0, mtime = 0;
+        if (!stat_signature(input, size, mtime))
+            return 0;
+        mix(size);
+        mix(mtime);
+    }
+    return h;
+}
+
+bool link_unmodified(const Config &conf) {
+    if (!fs::exists(link_output(conf)) || !fs::exists(link_cache_path()))
+        return false;
+    std::ifstream in(link_cache_path());
+    uint64_t cached = 0;
+    in >> cached;
+    return cached != 0 && cached == hash_link(conf);
+}
+
+void save_link_cache(const Config &conf) {
+    try {
+        std::ofstream out(link_cache_path(), std::ios::trunc);
+        ENABLE_EXCEPTIONS(out);
+        out << hash_link(conf);
+    } catch (const std::ios_base::failure &e) {
+        Logger::failLog("save_link_cache(): failed to write \"" +
+                            readable_path(link_cache_path()) + "\"",
+                        e.what());
     }
+}
+
+bool link_executable(const Config &conf) {
+    std::string cmd = link_command(conf);
     std::string cmd_no_log = cmd;
     cmd += " >> build/logs/log.out 2>&1";
     Logger::infoLog("linking command was: " + cmd_no_log);
 
-    return std::system(cmd.c_str()) == 0;
+    // the target is rewritten from here on: if the link doesn't finish, a
+    // leftover record must not vouch for what it leaves behind
+    std::error_code ec;
+    fs::remove(link_cache_path(), ec);
+
+    // any change means another build follows, which links again
+    std::function<bool()> interrupted;
+    if (changed_during_build)
+        interrupted = [] {
+            std::vector<PathId> changed;
+            return changed_during_build(changed);
+        };
+    int rc = run_command(cmd, interrupted);
+    if (rc == COMMAND_CANCELLED) {
+        build_cancelled = true;
+        Logger::warningLog("cancelled linking " + link_output(conf));
+        return true;
+    }
+    if (rc != 0)
+        return false;
+    save_link_cache(conf);
+    return true;
 }
 
 int compile_and_link(const Config &conf) {
     int modif_count = 0;
+    build_cancelled = false;
     if (!compile_objects(conf, modif_count)) {
         Logger::failLog("compilation failed.", "see build/logs/log.out");
         throw conf.unity_b ? "compile_unity()" : "compile_objects()";
     }
+    if (build_cancelled)
+        return modif_count;
 
     if (!conf.unity_b) {
         if (modif_count == 1) {
@@ -141,10 +360,23 @@ int compile_and_link(const Config &conf) {
         }
     }
 
+    if (!conf.rebuild_all && link_unmodified(conf)) {
+        Logger::debug("link up-to-date: " + link_output(conf));
+        // early cutoff: recompiled objects came out byte-identical, so the
+        // target (and anything run from it) is still up to date.
+        if (modif_count != 0)
+            Logger::successLog("recompiled objects are unchanged, skipped "
+                               "linking " +
+                               link_output(conf));
+        return 0;
+    }
+
     if (!link_executable(conf)) {
         Logger::failLog("linking failed.", "see build/logs/log.out");
         throw "link_executable()";
     }
+    if (build_cancelled)
+        return 0;
 
     return modif_count;
 }
@@ -1,9 +1,301 @@
 #ifndef COMPILEUNITY_H_
 #define COMPILEUNITY_H_
+#include "command.hh"
 #include "config.hh"
 #include "containers.hh"
+#include "diagnostics.hh"
 #include "helpers.hh"
 #include "logger.hh"
+#include "paths.hh"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+bool compile_jobs(const Config &conf, const std::vector<SourceFile *> &jobs,
+                  int &modified);
+
+// jumbo mode (unity_chunks / unity_chunk_size): the sources are split into
+// several unity translation units that compile in parallel, and only the
+// chunks with a changed member are rebuilt. each chunk is a SourceFile of
+// its own here, so it goes through the same scheduler, failure cache and
+// logs as a regular source.
+std::vector<SourceFile> unity_chunks;
+
+bool unity_chunked(const Config &conf) {
+    return conf.unity_b &&
+           (conf.unity_chunk_count > 0 || conf.unity_chunk_bytes > 0);
+}
+
+// adaptive unity (unity_adaptive): a source edited since the last clean
+// build is "hot" and compiles on its own, next to the chunks. the first
+// edit rebuilds its chunk without it, later ones only the file itself.
+// the set is kept in "build/.unity_hot", so it lasts across runs and
+// through a watch session; --clean folds everything back in.
+FlatMap<bool> unity_hot;
+bool unity_hot_loaded = false;
+
+bool unity_adaptive(const Config &conf) {
+    return conf.unity_b && conf.unity_adaptive;
+}
+
+// chunks, or hot files next to a single blob: builds that go through
+// compile_unity_chunks()
+bool unity_split(const Config &conf) {
+    return unity_chunked(conf) || unity_adaptive(conf);
+}
+
+fs::path unity_hot_path() { return fs::path("build/.unity_hot"); }
+
+void load_unity_hot() {
+    if (unity_hot_loaded)
+        return;
+    unity_hot_loaded = true;
+    std::ifstream in(unity_hot_path());
+    for (std::string line; std::getline(in, line);)
+        if (!line.empty())
+            unity_hot[path_pool.intern(line)] = true;
+}
+
+// adds the sources whose own content changed since their last build to
+// the hot set, or empties it on a clean build, and drops sources that are
+// gone. a first build, a header edit or a flag change doesn't make a
+// source hot, only an edit of the source itself does.
+void update_unity_hot(const Config &conf) {
+    load_unity_hot();
+    FlatMap<bool> hot;
+    if (!conf.rebuild_all) {
+        for (auto &[id, src] : sources) {
+            const uint64_t *old = old_hashes.find(id);
+            if ((old && *old != src.hash) || unity_hot.count(id))
+                hot[id] = true;
+        }
+    }
+    bool changed = hot.size() != unity_hot.size();
+    for (auto &[id, _] : hot)
+        changed |= !unity_hot.count(id);
+    unity_hot = std::move(hot);
+    if (!changed)
+        return;
+
+    std::ofstream out(unity_hot_path(), std::ios::trunc);
+    for (auto &[id, _] : unity_hot)
+        out << path_pool.view(id) << "\n";
+}
+
+// the hot sources, in path order
+std::vector<SourceFile *> unity_hot_sources(const Config &conf) {
+    std::vector<SourceFile *> hot;
+    if (!unity_adaptive(conf))
+        return hot;
+    load_unity_hot();
+    for (auto &[id, src] : sources)
+        if (unity_hot.count(id))
+            hot.push_back(&src);
+    std::sort(hot.begin(), hot.end(), path_order);
+    return hot;
+}
+
+// the members of each chunk. sources are taken in path order, so a chunk
+// keeps its neighbours (and the headers they share) from build to build.
+// by size if unity_chunk_bytes is set, in unity_chunk_count chunks of about
+// the same number of files if that is, and as one blob otherwise.
+std::vector<std::vector<SourceFile *>> partition_unity(const Config &conf) {
+    std::vector<SourceFile *> members;
+    for (auto &[_, src] : sources)
+        members.push_back(&src);
+    std::sort(members.begin(), members.end(), path_order);
+
+    std::vector<std::vector<SourceFile *>> chunks;
+    if (conf.unity_chunk_bytes > 0) {
+        uint64_t filled = 0;
+        for (SourceFile *src : members) {
+            uint64_t size = 0, mtime = 0;
+            stat_signature(path_pool.str(src->id), size, mtime);
+            if (chunks.empty() ||
+                (filled > 0 && filled + size > conf.unity_chunk_bytes)) {
+                chunks.emplace_back();
+                filled = 0;
+            }
+            chunks.back().push_back(src);
+            filled += size;
+        }
+    } else if (unity_chunked(conf)) {
+        size_t n = std::min<size_t>(conf.unity_chunk_count, members.size());
+        for (size_t i = 0; i < n; i++)
+            chunks.emplace_back(members.begin() + members.size() * i / n,
+                                members.begin() +
+                                    members.size() * (i + 1) / n);
+    } else if (!members.empty()) {
+        chunks.push_back(members);
+    }
+
+    // hot sources leave their chunk and the other chunks stay as they are.
+    // a chunk left empty keeps its number but isn't built.
+    if (unity_adaptive(conf)) {
+        load_unity_hot();
+        for (auto &chunk : chunks)
+            chunk.erase(std::remove_if(chunk.begin(), chunk.end(),
+                                       [](const SourceFile *src) {
+                                           return unity_hot.count(src->id);
+                                       }),
+                        chunk.end());
+    }
+    return chunks;
+}
+
+fs::path unity_chunk_path(const Config &conf, size_t i) {
+    if (!unity_chunked(conf))
+        return conf.unity_src_name;
+    fs::path p = conf.unity_src_name;
+    return p.parent_path() / (p.stem().string() + "_" + std::to_string(i) +
+                              p.extension().string());
+}
+
+fs::path unity_chunk_object(const Config &conf, size_t i) {
+    if (!unity_chunked(conf))
+        return conf.unity_obj;
+    return conf.unity_obj.parent_path() /
+           (conf.unity_obj.stem().string() + "_" + std::to_string(i) + ".o");
+}
+
+// the objects the unity build links: chunks, then hot sources
+std::vector<fs::path> unity_objects(const Config &conf) {
+    if (!unity_split(conf))
+        return {conf.unity_obj};
+    std::vector<fs::path> objects;
+    auto groups = partition_unity(conf);
+    for (size_t i = 0; i < groups.size(); i++)
+        if (!groups[i].empty())
+            objects.push_back(unity_chunk_object(conf, i));
+    for (const SourceFile *src : unity_hot_sources(conf))
+        objects.push_back(object_path(*src));
+    return objects;
+}
+
+// the translation unit of each unity object, for diagnostics
+std::vector<fs::path> unity_sources(const Config &conf) {
+    if (!unity_split(conf))
+        return {conf.unity_src_name};
+    std::vector<fs::path> tus;
+    auto groups = partition_unity(conf);
+    for (size_t i = 0; i < groups.size(); i++)
+        if (!groups[i].empty())
+            tus.push_back(unity_chunk_path(conf, i));
+    for (const SourceFile *src : unity_hot_sources(conf))
+        tus.push_back(source_path(*src));
+    return tus;
+}
+
+// the input fingerprint a unity object was last built from is recorded next
+// to it, "build/obj/unity_0.o" -> "build/obj/unity_0.inputs". the members'
+// modified flags only say what changed since the last build of any kind;
+// the record also catches edits that were built in another mode (plain,
+// chunked, adaptive) while this object sat unused.
+fs::path inputs_path(const fs::path &object) {
+    fs::path p = object;
+    p.replace_extension(".inputs");
+    return p;
+}
+
+bool built_from(const fs::path &object, uint64_t fingerprint) {
+    std::ifstream in(inputs_path(object));
+    uint64_t recorded = 0;
+    return in >> recorded && recorded == fingerprint;
+}
+
+void record_inputs(const fs::path &object, uint64_t fingerprint) {
+    std::ofstream out(inputs_path(object), std::ios::trunc);
+    out << fingerprint << "\n";
+}
+
+// writes `text` to `path` unless it is already there. true if it changed.
+bool write_if_changed(const fs::path &path, const std::string &text) {
+    std::ifstream in(path, std::ios::binary);
+    if (in) {
+        std::ostringstream old;
+        old << in.rdbuf();
+        if (old.str() == text)
+            return false;
+    }
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
+        throw "write_if_changed()";
+    out << text;
+    return true;
+}
+
+bool compile_unity_chunks(const Config &conf, int &modified) {
+    if (unity_adaptive(conf))
+        update_unity_hot(conf);
+    auto groups = partition_unity(conf);
+    unity_chunks.assign(groups.size(), SourceFile{});
+    // the objects of the chunks compiled by this build, empty for the rest
+    std::vector<fs::path> compiled(groups.size());
+    std::vector<SourceFile *> jobs;
+    for (size_t i = 0; i < groups.size(); i++) {
+        SourceFile &chunk = unity_chunks[i];
+        if (groups[i].empty())
+            continue;
+        // build/<stem>_<i>.cpp, its object is build/obj/<stem>_<i>.o
+        fs::path chunk_src = unity_chunk_path(conf, i);
+        fs::path chunk_obj = unity_chunk_object(conf, i);
+        chunk.id = path_pool.intern(normalize_path(chunk_src));
+
+        // keys the chunk's cached failure: what its members compile from
+        std::string text;
+        uint64_t h = 1469598103934665603ULL;
+        bool stale = conf.rebuild_all;
+        for (const SourceFile *src : groups[i]) {
+            text += "#include \"" + path_pool.str(src->id) + "\"\n";
+            h ^= input_fingerprint(*src);
+            h *= 1099511628211ULL;
+            stale |= src->modified;
+        }
+        chunk.hash = h;
+        // a new member list is a new translation unit
+        stale |= write_if_changed(chunk_src, text);
+        stale |= !fs::exists(chunk_obj) || !built_from(chunk_obj, h);
+
+        chunk.modified = stale;
+        if (stale) {
+            // recorded once it compiled
+            compiled[i] = chunk_obj;
+            jobs.push_back(&chunk);
+        } else {
+            replay_diagnostics(chunk_src, chunk_obj);
+        }
+    }
+    std::vector<SourceFile *> hot_jobs;
+    for (SourceFile *src : unity_hot_sources(conf)) {
+        // an object left from before the source went into a chunk is
+        // caught by its record
+        fs::path object = object_path(*src);
+        if (src->modified || !fs::exists(object) ||
+            !built_from(object, input_fingerprint(*src)))
+            hot_jobs.push_back(src);
+        else
+            replay_diagnostics(source_path(*src), object);
+    }
+    jobs.insert(jobs.end(), hot_jobs.begin(), hot_jobs.end());
+
+    bool ok = compile_jobs(conf, jobs, modified);
+    for (SourceFile *src : hot_jobs)
+        if (!src->modified)
+            record_inputs(object_path(*src), input_fingerprint(*src));
+    // members of a chunk that compiled are done, also if the rest of the
+    // build gets cancelled
+    for (size_t i = 0; i < groups.size(); i++) {
+        if (groups[i].empty() || unity_chunks[i].modified)
+            continue;
+        if (!compiled[i].empty())
+            record_inputs(compiled[i], unity_chunks[i].hash);
+        for (SourceFile *src : groups[i])
+            src->modified = false;
+    }
+    return ok;
+}
 
 fs::path generate_unity_file(const Config &conf) {
     std::ofstream out(conf.unity_src_name);
@@ -11,24 +303,28 @@ fs::path generate_unity_file(const Config &conf) {
         throw "generate_unity_file()";
 
     for (auto &[_, src] : sources) {
-        out << "#include \"" << fs::absolute(src.path).string() << "\"\n";
+        out << "#include \"" << path_pool.view(src.id) << "\"\n";
     }
 
     return conf.unity_src_name;
 }
 
 bool compile_unity(const Config &conf, int &modified) {
+    if (unity_split(conf))
+        return compile_unity_chunks(conf, modified);
+    uint64_t h = 1469598103934665603ULL;
     bool need = conf.rebuild_all;
-    if (!need) {
-        for (auto &[_, src] : sources) {
-            if (src.modified) {
-                need = true;
-                break;
-            }
-        }
+    for (auto &[_, src] : sources) {
+        h ^= input_fingerprint(src);
+        h *= 1099511628211ULL;
+        need |= src.modified;
     }
-    if (!need)
+    // the object is missing or outdated after building with chunks
+    need |= !fs::exists(conf.unity_obj) || !built_from(conf.unity_obj, h);
+    if (!need) {
+        replay_diagnostics(conf.unity_src_name, conf.unity_obj);
         return true;
+    }
     fs::path unity_src = generate_unity_file(conf);
     std::string cmd = conf.compiler;
     cmd += " -c " + unity_src.string();
@@ -38,10 +334,15 @@ bool compile_unity(const Config &conf, int &modified) {
     for (const auto &flag : conf.compile_flags)
         cmd += " " + flag;
     std::string cmd_no_log = cmd;
-    cmd += " >> build/log.out 2>&1";
+    std::string logfile = "build/logs/log_" +
+                          conf.unity_obj.filename().stem().string() + ".out";
+    cmd += " > " + logfile + " 2>&1";
     if (std::system(cmd.c_str()) != 0)
         return false;
+    record_inputs(conf.unity_obj, h);
+    std::string diags = store_diagnostics(conf.unity_obj, logfile);
     Logger::successLog("compiled unity: " + unity_src.string());
+    Logger::printDiagnostics(diags);
     Logger::infoLog("compile command was: " + cmd_no_log);
     modified = 1;
     return true;
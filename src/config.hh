@@ -25,9 +25,17 @@ struct StaticLib {
 struct Config {
     int parallel_jobs = std::thread::hardware_concurrency();
     bool rebuild_all = false;
+    bool retry_failed = false;
+    // system/third-party headers, tracked per include root group
     bool track_external_headers = false;
+    bool token_header_hash = false;
+    // fingerprint git-tracked files by their blob id in .git/index
+    bool use_git_index = false;
     bool show_help = false;
     bool watch_mode = false;
+    bool speculative = false;
+    // `mkc daemon`, see daemon.hh
+    bool daemon_mode = false;
     bool run_mode = false;
     bool make_shared = false;
     bool log_immediately = false;
@@ -35,9 +43,17 @@ struct Config {
     bool benchmark = false;
     bool dry_run = false;
     bool dry_run_toml = false;
+    bool warnings_summary = false;
     bool unity_b = false;
     fs::path unity_src_name = "";
     fs::path unity_obj;
+    // jumbo mode: split the unity build into this many chunks, or into
+    // chunks of at most this many bytes of source (takes precedence)
+    int unity_chunk_count = 0;
+    uint64_t unity_chunk_bytes = 0;
+    // compile sources edited since the last clean build outside the unity
+    // build, see compiler_unity.hh
+    bool unity_adaptive = false;
     std::string benchmark_msg;
     std::string executable_name = "app";
     std::string compiler = "g++";
@@ -51,6 +67,8 @@ struct Config {
     std::vector<std::string> link_flags;
     std::vector<fs::path> include_dirs;
     std::vector<PkgDependency> pkg_deps;
+    // pkg-config --static: Libs.private and Requires.private libs too
+    bool pkg_static = false;
     std::vector<StaticLib> static_libs;
     std::vector<fs::path> explicit_sources;
     std::vector<fs::path> exclude_dirs = {fs::weakly_canonical("build")};
@@ -1,27 +1,100 @@
 #ifndef CONTAINERS_H_
 #define CONTAINERS_H_
+#include "helpers.hh"
+#include "paths.hh"
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
 #include <string>
-#include <unordered_map>
 #include <vector>
 namespace fs = std::filesystem;
 
+// per-file records hold no strings: a file is its PathId, and its path and
+// object path are derived from the interned path when needed, see
+// source_path() and object_path().
 struct SourceFile {
-    fs::path path;
-    fs::path object;
-    std::vector<fs::path> includes;
+    PathId id = NO_PATH;
+    // this source's row of the include graph, see includes_of()
+    uint32_t inc_begin = 0;
+    uint32_t inc_end = 0;
     uint64_t hash = 0;
+    // hash of the exact compile command, see compile_command()
+    uint64_t cmd_hash = 0;
+    // hash of the produced object file, 0 until known
+    uint64_t obj_hash = 0;
     bool modified = false;
 };
 
 struct HeaderFile {
-    fs::path path;
     uint64_t hash = 0;
+    // headers are only hashed once a source is known to include them
+    bool hashed = false;
 };
 
-std::unordered_map<std::string, SourceFile> sources;
-std::unordered_map<std::string, HeaderFile> headers;
-std::unordered_map<std::string, uint64_t> old_hashes;
+// a header hash together with the stat signature it was computed for
+struct HashMemo {
+    uint64_t size = 0;
+    uint64_t mtime = 0;
+    uint64_t hash = 0;
+    bool tokens = false;
+    bool git_blob = false;
+};
+
+// all keyed by the interned normalized path, see paths.hh
+FlatMap<SourceFile> sources;
+FlatMap<HeaderFile> headers;
+FlatMap<HashMemo> header_memo;
+// fingerprints of external header groups, see external_headers.hh. group
+// keys are interned like paths, with a leading '@'.
+FlatMap<uint64_t> external_hashes;
+FlatMap<uint64_t> old_hashes;
+FlatMap<uint64_t> old_cmd_hashes;
+FlatMap<uint64_t> old_obj_hashes;
+
+// `id`'s path, relative to the working directory if it is under it. the
+// spelling used in compile commands and in the logs.
+std::string relative_path(PathId id) {
+    std::string_view p = path_pool.view(id);
+    std::string cwd = normalize_path(".");
+    if (p.size() > cwd.size() && p.compare(0, cwd.size(), cwd) == 0 &&
+        p[cwd.size()] == '/')
+        p.remove_prefix(cwd.size() + 1);
+    return std::string(p);
+}
+
+std::string source_path(const SourceFile &src) {
+    return relative_path(src.id);
+}
+
+// "build/obj/<stem>.o"
+fs::path object_path(const SourceFile &src) {
+    std::string_view p = path_pool.view(src.id);
+    std::string_view name = p.substr(p.rfind('/') + 1);
+    return fs::path("build/obj") /
+           (std::string(name.substr(0, name.rfind('.'))) + ".o");
+}
+
+// sorts by path, e.g. for a stable unity order
+bool path_order(const SourceFile *a, const SourceFile *b) {
+    return path_pool.view(a->id) < path_pool.view(b->id);
+}
+
+// the include graph in compressed sparse row form: every source's includes
+// are one contiguous run of this array. rebuilt with the depfiles each build.
+std::vector<PathId> include_edges;
+
+PathIdRange includes_of(const SourceFile &src) {
+    return {include_edges.data() + src.inc_begin,
+            include_edges.data() + src.inc_end};
+}
+
+// the reverse graph, header -> sources including it. incremental builds
+// (watch mode, the daemon) use it to go from a changed header to the
+// sources to rebuild.
+FlatMap<std::vector<PathId>> include_users;
+
+void link_include_users(const SourceFile &src) {
+    for (PathId inc : includes_of(src))
+        include_users[inc].push_back(src.id);
+}
 #endif
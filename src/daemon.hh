@@ -0,0 +1,337 @@
+#ifndef DAEMON_H_
+#define DAEMON_H_
+#include "benchmark.hh"
+#include "build_procedure.hh"
+#include "cli.hh"
+#include "config.hh"
+#include "file_watch.hh"
+#include "logger.hh"
+#include "parse_config.hh"
+#include "pkg_config.hh"
+#include <memory>
+#include <string>
+#include <vector>
+
+// `mkc daemon` keeps the build state of one project in memory: the loaded
+// config and pkg-config flags, the include graph, hashes, the toolchain
+// identity and the file watcher. a plain `mkc` run in the same directory
+// sends its arguments over DAEMON_SOCKET and gets the log streamed back, so
+// a build with nothing to do is a round trip instead of a scan.
+//
+// request:  cwd '\0' arg '\0' arg '\0' ...      (then the client shuts down
+//                                                its write side)
+// response: log output, then '\0' and one byte of exit status
+#define DAEMON_SOCKET "build/.mkc.sock"
+// status byte of a request the daemon won't serve, the client builds itself
+#define DAEMON_REFUSED 255
+
+int run_daemon(Config config, int argc, char *argv[]);
+
+// hands this run to a daemon serving `config.root_dir`. false if there is
+// none, or it refused; `status` is the exit code of the build otherwise.
+bool forward_to_daemon(const Config &config, int argc, char *argv[],
+                       int &status);
+
+#ifdef __unix__
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+bool socket_address(const std::string &path, sockaddr_un &addr) {
+    addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        return false;
+    path.copy(addr.sun_path, path.size());
+    return true;
+}
+
+// compilers and the program run with --run don't need to see the sockets
+int close_on_exec(int fd) {
+    if (fd != -1)
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+int connect_daemon(const std::string &path) {
+    sockaddr_un addr;
+    if (!socket_address(path, addr))
+        return -1;
+    int fd = close_on_exec(socket(AF_UNIX, SOCK_STREAM, 0));
+    if (fd == -1)
+        return -1;
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool forward_to_daemon(const Config &config, int argc, char *argv[],
+                       int &status) {
+    int fd = connect_daemon(config.root_dir + "/" DAEMON_SOCKET);
+    if (fd == -1)
+        return false;
+
+    std::error_code ec;
+    std::string request = fs::current_path(ec).string();
+    request.push_back('\0');
+    for (int i = 1; i < argc; i++) {
+        request += argv[i];
+        request.push_back('\0');
+    }
+    if (!write_all(fd, request.data(), request.size())) {
+        close(fd);
+        return false;
+    }
+    shutdown(fd, SHUT_WR);
+
+    // the last two bytes are the trailer, everything before is log
+    std::string held;
+    char buf[4096];
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        held.append(buf, n);
+        if (held.size() > 2) {
+            write_all(STDOUT_FILENO, held.data(), held.size() - 2);
+            held.erase(0, held.size() - 2);
+        }
+    }
+    close(fd);
+
+    if (held.size() != 2 || held[0] != '\0') {
+        // the daemon went away mid-build
+        write_all(STDOUT_FILENO, held.data(), held.size());
+        std::cout << "\n";
+        Logger::failLog("lost the connection to the mkc daemon");
+        std::cout << std::endl;
+        status = 1;
+        return true;
+    }
+    status = static_cast<unsigned char>(held[1]);
+    return status != DAEMON_REFUSED;
+}
+
+// what the daemon serves: the config of the last request and the arguments
+// and toml state it was loaded from
+struct DaemonState {
+    Config config;
+    std::vector<std::string> args;
+    fs::file_time_type toml_time;
+    bool loaded = false;
+};
+
+fs::file_time_type toml_mtime(const Config &config) {
+    std::error_code ec;
+    auto t = fs::last_write_time(config.config_file, ec);
+    return ec ? fs::file_time_type::min() : t;
+}
+
+// the same steps main() takes, minus forwarding
+bool load_request_config(const std::vector<std::string> &args,
+                         Config &config) {
+    std::vector<char *> argv{const_cast<char *>("mkc")};
+    for (const auto &a : args)
+        argv.push_back(const_cast<char *>(a.c_str()));
+    try {
+        config = parse_cli_args(static_cast<int>(argv.size()), argv.data());
+    } catch (const std::exception &e) {
+        Logger::failLog(std::string("bad request: ") + e.what());
+        return false;
+    } catch (...) {
+        return false;
+    }
+    if (!finish_config(config))
+        return false;
+    resolve_pkg_config(config);
+    return true;
+}
+
+// one build for one client. the config is reloaded only when the arguments
+// or the toml file changed; then the tables are rebuilt by a full build,
+// otherwise the watcher's events since the last request drive an
+// incremental one. without a watcher every request is a full build.
+int serve_request(DaemonState &state, const std::vector<std::string> &args) {
+    std::vector<WatchEvent> events;
+    take_watched(events);
+    try {
+        if (!state.loaded || args != state.args ||
+            toml_mtime(state.config) != state.toml_time) {
+            state.loaded = false;
+            Config fresh;
+            if (!load_request_config(args, fresh))
+                return 1;
+            state.config = fresh;
+            state.args = args;
+            state.toml_time = toml_mtime(fresh);
+            state.loaded = true;
+            build_state_valid = false;
+        } else {
+            Logger::set_log_verbosity(state.config.log_verbosity);
+            Logger::set_log_immediacy(state.config.log_immediately);
+        }
+        if (!watching())
+            build_state_valid = false;
+
+        std::unique_ptr<BuildTimer> timer;
+        if (state.config.benchmark)
+            timer = std::make_unique<BuildTimer>(
+                "finished in: ", state.config.benchmark_msg.c_str());
+        incremental_build(state.config, events);
+    } catch (...) {
+        return 1;
+    }
+    return 0;
+}
+
+std::string daemon_socket_path;
+
+void remove_daemon_socket(int) {
+    unlink(daemon_socket_path.c_str());
+    _exit(0);
+}
+
+void handle_client(int client, DaemonState &state, const std::string &cwd) {
+    std::string request;
+    char buf[4096];
+    while (true) {
+        ssize_t n = read(client, buf, sizeof(buf));
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        request.append(buf, n);
+    }
+
+    std::vector<std::string> fields;
+    for (size_t start = 0; start < request.size();) {
+        size_t end = request.find('\0', start);
+        if (end == std::string::npos)
+            break;
+        fields.push_back(request.substr(start, end - start));
+        start = end + 1;
+    }
+    // relative paths in the arguments and in the build are cwd based
+    if (fields.empty() || fields[0] != cwd) {
+        char trailer[2] = {'\0', static_cast<char>(DAEMON_REFUSED)};
+        write_all(client, trailer, 2);
+        return;
+    }
+    fields.erase(fields.begin());
+
+    // the build logs to stdout and stderr, point both at the client
+    std::cout.flush();
+    std::fflush(stdout);
+    int saved_out = dup(STDOUT_FILENO);
+    int saved_err = dup(STDERR_FILENO);
+    dup2(client, STDOUT_FILENO);
+    dup2(client, STDERR_FILENO);
+
+    int status = serve_request(state, fields);
+    std::cout << std::endl;
+    std::fflush(stdout);
+    std::cerr.flush();
+
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+    close(saved_out);
+    close(saved_err);
+
+    char trailer[2] = {'\0', static_cast<char>(status)};
+    write_all(client, trailer, 2);
+}
+
+int run_daemon(Config config, int argc, char *argv[]) {
+    init_working_dir(config);
+    daemon_socket_path = config.root_dir + "/" DAEMON_SOCKET;
+    sockaddr_un addr;
+    if (!socket_address(daemon_socket_path, addr)) {
+        Logger::failLog("socket path too long: " + daemon_socket_path);
+        return 1;
+    }
+    int running = connect_daemon(daemon_socket_path);
+    if (running != -1) {
+        close(running);
+        Logger::failLog("a daemon already serves " + config.root_dir);
+        std::cout << std::endl;
+        return 1;
+    }
+    // left behind by a daemon that didn't exit cleanly
+    unlink(daemon_socket_path.c_str());
+
+    int sock = close_on_exec(socket(AF_UNIX, SOCK_STREAM, 0));
+    if (sock == -1 ||
+        bind(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1 ||
+        listen(sock, 16) == -1) {
+        Logger::failLog("can't listen on " + daemon_socket_path);
+        std::cout << std::endl;
+        return 1;
+    }
+    std::signal(SIGINT, remove_daemon_socket);
+    std::signal(SIGTERM, remove_daemon_socket);
+    // a client that goes away mid-build must not take the daemon with it
+    std::signal(SIGPIPE, SIG_IGN);
+
+    // watching starts before the first build, so nothing it misses goes
+    // unseen
+    if (!start_watcher(config) || !watching())
+        Logger::warningLog("no complete file watcher, every request "
+                           "rescans");
+
+    // the daemon's own arguments, minus `daemon`, are what a plain run
+    // of the same command line asks for
+    DaemonState state;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++)
+        if (std::string(argv[i]) != "daemon")
+            args.push_back(argv[i]);
+    serve_request(state, args);
+
+    std::error_code ec;
+    std::string cwd = fs::current_path(ec).string();
+    Logger::warningLog("daemon listening on " + daemon_socket_path);
+    std::cout << std::endl;
+    while (true) {
+        int client = close_on_exec(accept(sock, nullptr, nullptr));
+        if (client == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            Logger::failLog("daemon stopped: accept() failed");
+            unlink(daemon_socket_path.c_str());
+            return 1;
+        }
+        handle_client(client, state, cwd);
+        close(client);
+    }
+}
+#else
+int run_daemon(Config, int, char *[]) {
+    std::cerr << "\ndaemon not implemented on this platform\n";
+    return 1;
+}
+
+bool forward_to_daemon(const Config &, int, char *[], int &) { return false; }
+#endif
+#endif
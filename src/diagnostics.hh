@@ -0,0 +1,157 @@
+#ifndef DIAGNOSTICS_H_
+#define DIAGNOSTICS_H_
+#include "config.hh"
+#include "containers.hh"
+#include "exceptions.hh"
+#include "helpers.hh"
+#include "logger.hh"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// see compiler_unity.hh
+std::vector<fs::path> unity_objects(const Config &conf);
+std::vector<fs::path> unity_sources(const Config &conf);
+
+// compiler output of the last successful compile of an object lives next to
+// it, "build/obj/foo.o" -> "build/obj/foo.diag", so it can be replayed when
+// the object is reused instead of recompiled.
+fs::path diag_path(const fs::path &object) {
+    fs::path p = object;
+    p.replace_extension(".diag");
+    return p;
+}
+
+std::string read_text_file(const fs::path &p) {
+    std::ifstream in(p, std::ios::binary);
+    if (!in)
+        return "";
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+// copies the compile log of a freshly built object into its .diag record and
+// returns the captured text. an empty log removes any stale record.
+std::string store_diagnostics(const fs::path &object,
+                              const fs::path &logfile) {
+    std::string text = read_text_file(logfile);
+    fs::path diag = diag_path(object);
+    try {
+        if (text.empty()) {
+            fs::remove(diag);
+            return text;
+        }
+        std::ofstream out(diag, std::ios::trunc | std::ios::binary);
+        ENABLE_EXCEPTIONS(out);
+        out << text;
+    } catch (const std::exception &e) {
+        Logger::failLog("store_diagnostics(): failed to write \"" +
+                            readable_path(diag) + "\"",
+                        e.what());
+    }
+    return text;
+}
+
+std::string load_diagnostics(const fs::path &object) {
+    return read_text_file(diag_path(object));
+}
+
+// prints the cached diagnostics of an object that was not recompiled.
+void replay_diagnostics(const fs::path &src, const fs::path &object) {
+    std::string text = load_diagnostics(object);
+    if (text.empty())
+        return;
+    Logger::warningLog("cached diagnostics: " + readable_path(src));
+    Logger::printDiagnostics(text);
+}
+
+// a failed compile is recorded as "build/obj/foo.fail": the fingerprint of
+// the inputs it failed with on the first line, the compiler output after it.
+fs::path fail_path(const fs::path &object) {
+    fs::path p = object;
+    p.replace_extension(".fail");
+    return p;
+}
+
+void store_failure(const fs::path &object, uint64_t fingerprint,
+                   const std::string &text) {
+    fs::path fail = fail_path(object);
+    try {
+        std::ofstream out(fail, std::ios::trunc | std::ios::binary);
+        ENABLE_EXCEPTIONS(out);
+        out << fingerprint << "\n" << text;
+    } catch (const std::exception &e) {
+        Logger::failLog("store_failure(): failed to write \"" +
+                            readable_path(fail) + "\"",
+                        e.what());
+    }
+}
+
+// returns true and fills `text` if the object failed last time with exactly
+// the same inputs.
+bool cached_failure(const fs::path &object, uint64_t fingerprint,
+                    std::string &text) {
+    std::ifstream in(fail_path(object), std::ios::binary);
+    if (!in)
+        return false;
+    uint64_t recorded;
+    if (!(in >> recorded) || recorded != fingerprint)
+        return false;
+    in.ignore(1);
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    text = ss.str();
+    return true;
+}
+
+void clear_failure(const fs::path &object) {
+    std::error_code ec;
+    fs::remove(fail_path(object), ec);
+}
+
+// --warnings-summary: print every recorded diagnostic without compiling.
+void print_warnings_summary(const Config &conf) {
+    std::vector<const SourceFile *> srcs;
+    for (const auto &[_, src] : sources)
+        srcs.push_back(&src);
+    std::sort(srcs.begin(), srcs.end(), path_order);
+
+    int with_diags = 0;
+    auto show = [&](const fs::path &src, const fs::path &object) {
+        std::string text = load_diagnostics(object);
+        if (text.empty())
+            return;
+        with_diags++;
+        std::string note = fs::exists(object) ? "" : " (object missing)";
+        Logger::warningLog("diagnostics: " + readable_path(src) + note);
+        Logger::printDiagnostics(text);
+    };
+
+    for (const auto &lib : conf.static_libs)
+        for (const auto &src : lib.sources)
+            show(src, fs::path("build/lib") / lib.name /
+                          src.filename().replace_extension(".o"));
+    if (conf.unity_b) {
+        std::vector<fs::path> tus = unity_sources(conf);
+        std::vector<fs::path> objects = unity_objects(conf);
+        for (size_t i = 0; i < tus.size(); i++)
+            show(tus[i], objects[i]);
+    } else {
+        for (const SourceFile *src : srcs)
+            show(source_path(*src), object_path(*src));
+    }
+
+    if (with_diags == 0)
+        Logger::successLog("no cached diagnostics.");
+    else
+        Logger::successLog(std::to_string(with_diags) +
+                           " translation unit(s) with cached diagnostics.");
+}
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef EXCLUDE_H_
+#define EXCLUDE_H_
+#include "config.hh"
+#include "helpers.hh"
+#include <filesystem>
+#include <fnmatch.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// exclude_dirs and exclude_exts, compiled once per build so that checking a
+// path is a few hash lookups instead of canonicalizing it per exclusion.
+// all queries take paths relative to the project root ("src/foo.cc").
+//
+// an exclude_dirs entry is one of:
+//  - a directory: it is canonicalized once and stored in a trie of path
+//    components; the walker prunes it and never descends into it.
+//  - a plain name: any file with that name is excluded.
+//  - a .gitignore-style glob (*, ?, [...]): a pattern without a '/' matches
+//    the name of any file or directory, one with a '/' is anchored to the
+//    root, and a trailing '/' makes it match directories only.
+struct ExclusionMatcher {
+    struct Node {
+        std::unordered_map<std::string, std::unique_ptr<Node>> children;
+        bool excluded = false;
+    };
+    struct Glob {
+        std::string pattern;
+        bool anchored = false;
+        bool dir_only = false;
+    };
+
+    Node dirs;
+    std::unordered_set<std::string> names;
+    std::unordered_set<std::string> exts;
+    std::vector<Glob> globs;
+
+    void add_dir(const std::string &rel) {
+        Node *n = &dirs;
+        for (const auto &part : fs::path(rel)) {
+            auto &child = n->children[part.string()];
+            if (!child)
+                child = std::make_unique<Node>();
+            n = child.get();
+        }
+        n->excluded = true;
+    }
+
+    bool glob_match(const std::string &rel, const std::string &name,
+                    bool is_dir) const {
+        for (const auto &g : globs) {
+            if (g.dir_only && !is_dir)
+                continue;
+            if (g.anchored ? fnmatch(g.pattern.c_str(), rel.c_str(),
+                                     FNM_PATHNAME) == 0
+                           : fnmatch(g.pattern.c_str(), name.c_str(), 0) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    // a directory met during the walk. its parents were already checked.
+    bool excluded_dir(const std::string &rel, const std::string &name) const {
+        const Node *n = &dirs;
+        for (const auto &part : fs::path(rel)) {
+            auto it = n->children.find(part.string());
+            if (it == n->children.end()) {
+                n = nullptr;
+                break;
+            }
+            n = it->second.get();
+        }
+        if (n && n->excluded)
+            return true;
+        return glob_match(rel, name, true);
+    }
+
+    // a file met during the walk, inside a directory that is not excluded.
+    bool excluded_file(const std::string &rel, const std::string &name,
+                       const std::string &ext) const {
+        if (names.count(name) || exts.count(ext))
+            return true;
+        return glob_match(rel, name, false);
+    }
+
+    // any path, checking all of its parent directories as well.
+    bool excluded_path(const std::string &rel, bool is_dir) const {
+        fs::path p(rel);
+        const Node *n = &dirs;
+        std::string prefix;
+        for (auto it = p.begin(); it != p.end(); ++it) {
+            std::string part = it->string();
+            bool last = std::next(it) == p.end();
+            prefix += prefix.empty() ? part : "/" + part;
+            if (n) {
+                auto child = n->children.find(part);
+                n = child == n->children.end() ? nullptr : child->second.get();
+                if (n && n->excluded)
+                    return true;
+            }
+            if (!last && glob_match(prefix, part, true))
+                return true;
+        }
+        if (is_dir)
+            return glob_match(rel, p.filename().string(), true);
+        return excluded_file(rel, p.filename().string(),
+                             p.extension().string());
+    }
+};
+
+ExclusionMatcher exclusions;
+
+void compile_exclusions(const Config &conf) {
+    exclusions = ExclusionMatcher{};
+    fs::path root = normalize_fs_path(conf.root_dir);
+
+    for (const auto &ext : conf.exclude_exts)
+        exclusions.exts.insert(ext);
+
+    for (const auto &excl : conf.exclude_dirs) {
+        std::string s = excl.string();
+        if (s.empty())
+            continue;
+
+        if (s.find_first_of("*?[") != std::string::npos) {
+            ExclusionMatcher::Glob g;
+            if (s.back() == '/') {
+                g.dir_only = true;
+                s.pop_back();
+            }
+            if (s.find('/') != std::string::npos) {
+                g.anchored = true;
+                if (s[0] == '/')
+                    s.erase(0, 1);
+            }
+            g.pattern = s;
+            exclusions.globs.push_back(std::move(g));
+            continue;
+        }
+
+        // a file or directory with this name, as before
+        exclusions.names.insert(excl.filename().string());
+        fs::path dir = normalize_fs_path(excl.is_absolute() ? excl
+                                                            : root / excl);
+        std::error_code ec;
+        if (!fs::is_directory(dir, ec))
+            continue;
+        fs::path rel = dir.lexically_relative(root);
+        if (rel.empty() || rel == "." || *rel.begin() == "..")
+            continue;
+        exclusions.add_dir(rel.string());
+    }
+}
+
+#endif
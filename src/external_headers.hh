@@ -0,0 +1,129 @@
+#ifndef EXTERNALHEADERS_H_
+#define EXTERNALHEADERS_H_
+#include "config.hh"
+#include "containers.hh"
+#include "helpers.hh"
+#include "logger.hh"
+#include "pkg_config.hh"
+#include "toolchain.hh"
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// with track_external_headers on, system and third-party headers are not
+// hashed one by one. each is assigned to the include root it was found
+// under, and the root decides how it is fingerprinted:
+//  - roots owned by the compiler install (libstdc++, compiler builtins)
+//    change exactly when the toolchain does, so they share its identity.
+//  - other system roots (sysroot, /usr/local, pkg-config prefixes) are
+//    fingerprinted per directory by the directory's stat signature. package
+//    managers replace files rather than rewrite them, which bumps the mtime
+//    of the directory holding them.
+//  - the user's own include dirs and -I/-isystem flags are edited in place,
+//    which leaves the directory alone, so their headers are not grouped and
+//    get hashed one by one like project headers (behind the stat memo).
+// grouped headers cost at most one stat per directory in use.
+
+struct ExternalRoot {
+    std::string path;
+    bool compiler_owned = false;
+    bool per_header = false;
+};
+
+// the roots, longest first so the first prefix match is the closest one.
+std::vector<ExternalRoot> external_roots;
+// header -> group it belongs to, NO_PATH if it has none
+FlatMap<PathId> external_header_groups;
+
+bool is_compiler_owned(const std::string &dir) {
+    return dir.find("/c++/") != std::string::npos ||
+           dir.find("/gcc/") != std::string::npos ||
+           dir.find("/clang/") != std::string::npos;
+}
+
+void load_external_roots(const Config &conf) {
+    external_roots.clear();
+    external_header_groups.clear();
+    external_hashes.clear();
+    std::string project_root = normalize_path(conf.root_dir);
+
+    auto add = [&](const fs::path &dir, bool system, bool per_header) {
+        std::string d = normalize_path(dir);
+        if (d.empty() || (d + "/").rfind(project_root + "/", 0) == 0)
+            return;
+        for (const auto &r : external_roots)
+            if (r.path == d)
+                return;
+        external_roots.push_back(
+            {d, system && is_compiler_owned(d), per_header});
+    };
+
+    for (const auto &dir : toolchain.include_dirs)
+        add(dir, true, false);
+    for (const auto &dir : conf.include_dirs)
+        add(dir, false, true);
+    // -I/-isystem flags. the ones pkg-config contributed point into
+    // package prefixes, the rest are the user's
+    const auto &pkg = pkg_resolution.cflags;
+    for (size_t i = 0; i < conf.compile_flags.size(); i++) {
+        const std::string &f = conf.compile_flags[i];
+        bool user = std::find(pkg.begin(), pkg.end(), f) == pkg.end();
+        if (f.rfind("-isystem", 0) == 0) {
+            if (f.size() > 8)
+                add(f.substr(8), false, user);
+            else if (i + 1 < conf.compile_flags.size())
+                add(conf.compile_flags[i + 1], false, user);
+        } else if (f.rfind("-I", 0) == 0 && f.size() > 2) {
+            add(f.substr(2), false, user);
+        }
+    }
+
+    std::sort(external_roots.begin(), external_roots.end(),
+              [](const ExternalRoot &a, const ExternalRoot &b) {
+                  return a.path.size() > b.path.size();
+              });
+}
+
+// cache key of the group `id` belongs to, or NO_PATH if it is not under
+// any known root and has to be hashed on its own.
+PathId external_group(PathId id) {
+    if (const PathId *memo = external_header_groups.find(id))
+        return *memo;
+
+    std::string header = path_pool.str(id);
+    std::string key;
+    PathId group = NO_PATH;
+    for (const auto &root : external_roots) {
+        if (header.rfind(root.path + "/", 0) != 0)
+            continue;
+        if (root.per_header)
+            break;
+        // '@' keeps group keys apart from file paths in the cache
+        key = root.compiler_owned
+                  ? "@" + root.path
+                  : "@" + fs::path(header).parent_path().string();
+        group = path_pool.intern(key);
+        if (!external_hashes.count(group)) {
+            uint64_t h = hash_string(key);
+            if (root.compiler_owned) {
+                h ^= toolchain.identity;
+                h *= 1099511628211ULL;
+            } else {
+                uint64_t size = 0, mtime = 0;
+                stat_signature(key.substr(1), size, mtime);
+                h ^= mtime;
+                h *= 1099511628211ULL;
+            }
+            external_hashes[group] = h;
+            Logger::debug("external header group: " + key);
+        }
+        break;
+    }
+    external_header_groups[id] = group;
+    return group;
+}
+
+#endif
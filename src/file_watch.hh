@@ -1,67 +1,388 @@
 #ifndef FILEWATCH_H_
 #define FILEWATCH_H_
 #include "config.hh"
+#include "containers.hh"
+#include "exclude.hh"
+#include "helpers.hh"
+#include "logger.hh"
+#include <string>
+#include <vector>
 
 // number of milliseconds that will be used to debounce the file_watcher
 // so that it doesn't retrigger builds too quick.
 #define DEBOUNCE_MS 100
-// returns true on detecting change, false on error.
-bool file_watcher(const Config &config);
+
+// one inotify event, with the full path of the file it is about
+struct WatchEvent {
+    std::string path;
+    uint32_t mask = 0;
+};
+
+// blocks until a file the build cares about changes and fills `events`
+// with the relevant part of what happened, debounced. returns false on
+// error.
+bool file_watcher(const Config &config, std::vector<WatchEvent> &events);
+
+// true if `events` change which files exist rather than what is in them
+bool structural_change(const std::vector<WatchEvent> &events);
+
+// true for the event of a writer closing the file
+bool closed_after_write(const WatchEvent &ev);
+
+// called with the first events of a burst, before debouncing
+void (*on_first_events)(const Config &config,
+                        const std::vector<WatchEvent> &events) = nullptr;
+
+// starts watching the project, if that hasn't happened yet
+bool start_watcher(const Config &config);
+
+// true while the watcher runs and sees the whole tree. otherwise edits can
+// go unseen, and an empty take_watched() says nothing about what changed.
+bool watching();
+
+// non-blocking: every relevant event since the last file_watcher() or
+// take_watched() call.
+void take_watched(std::vector<WatchEvent> &events);
+
+// non-blocking, for use while a build runs: the relevant events queued since
+// the last call. they are handed out again by the next file_watcher().
+bool poll_watcher(std::vector<WatchEvent> &fresh);
 
 #ifdef __linux__
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
+#include <cstring>
 #include <fcntl.h>
 #include <filesystem>
 #include <sys/inotify.h>
 #include <thread>
 #include <unistd.h>
+#include <unordered_map>
 namespace fs = std::filesystem;
 
-bool watch(const fs::path &root) {
-    std::vector<int> watches;
-    int fd = inotify_init1(0);
-    if (fd == -1)
-        return false;
+// true if any of `events` added, removed or renamed a directory entry,
+// which is what can change how a path canonicalizes.
+bool has_entry_events(const std::vector<WatchEvent> &events) {
+    const uint32_t entry_events =
+        IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVED_FROM | IN_MOVED_TO;
+    for (const auto &ev : events)
+        if (ev.mask & (entry_events | IN_Q_OVERFLOW))
+            return true;
+    return false;
+}
 
-    uint32_t mask = IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE |
-                    IN_DELETE_SELF | IN_MOVED_FROM | IN_MOVED_TO;
+// the inotify instance and its watches live as long as the process. events
+// that arrive while a build runs stay queued in the kernel and are picked
+// up by the next wait(), so no edit is lost; directories are watched and
+// unwatched as they come and go.
+class FileWatcher {
+  public:
+    ~FileWatcher() {
+        if (fd != -1)
+            close(fd);
+    }
 
-    auto add_watch = [&](const fs::path &p) {
-        int wd = inotify_add_watch(fd, p.c_str(), mask);
-        if (wd != -1)
-            watches.push_back(wd);
-    };
+    bool start(const fs::path &root_dir, const ExclusionMatcher &excl) {
+        fd = inotify_init1(IN_CLOEXEC);
+        if (fd == -1)
+            return false;
+        root = normalize_path(root_dir);
+        exclusions = &excl;
+        add_tree(root, nullptr);
+        return true;
+    }
 
-    add_watch(root);
-    for (const auto &entry : fs::recursive_directory_iterator(root)) {
-        if (entry.is_directory()) {
-            add_watch(entry.path());
+    bool started() const { return fd != -1; }
+
+    // false once a directory couldn't be watched
+    bool complete() const { return !missed; }
+
+    // waits for the first relevant event
+    bool wait(std::vector<WatchEvent> &events) {
+        events = std::move(pending);
+        pending.clear();
+        while (events.empty()) {
+            if (!read_events(events, true))
+                return false;
+            filter(events);
         }
+        return true;
     }
 
-    char buf[4096];
-    ssize_t len = read(fd, buf, sizeof(buf));
-
-    if (len > 0) {
+    // gives the rest of the burst DEBOUNCE_MS to arrive, and adds the
+    // relevant part of it to `events`
+    void debounce(std::vector<WatchEvent> &events) {
         std::this_thread::sleep_for(std::chrono::milliseconds(DEBOUNCE_MS));
-        fcntl(fd, F_SETFL, O_NONBLOCK);
-        while (read(fd, buf, sizeof(buf)) > 0) {
+        std::vector<WatchEvent> more;
+        read_events(more, false);
+        filter(more);
+        events.insert(events.end(), more.begin(), more.end());
+    }
+
+    void take(std::vector<WatchEvent> &events) {
+        std::vector<WatchEvent> fresh;
+        poll(fresh);
+        events = std::move(pending);
+        pending.clear();
+    }
+
+    bool poll(std::vector<WatchEvent> &fresh) {
+        fresh.clear();
+        read_events(fresh, false);
+        filter(fresh);
+        pending.insert(pending.end(), fresh.begin(), fresh.end());
+        return !fresh.empty();
+    }
+
+  private:
+    int fd = -1;
+    std::string root;
+    // seen by poll() during a build, not yet returned by wait()
+    std::vector<WatchEvent> pending;
+    const ExclusionMatcher *exclusions = nullptr;
+    std::unordered_map<int, std::string> dir_of_wd;
+    std::unordered_map<std::string, int> wd_of_dir;
+    // a directory below root has no watch, edits in it go unseen
+    bool missed = false;
+
+    // no IN_ATTRIB, so chmod is ignored. IN_CLOSE_WRITE tells speculation
+    // a save is done (closed_after_write()), so touch or any open for
+    // writing still wakes the loop. the content hashes of sources and
+    // headers then find nothing changed; an untracked include (.inl) has
+    // no hash, and its includers rebuild.
+    static constexpr uint32_t MASK = IN_MODIFY | IN_CREATE | IN_DELETE |
+                                     IN_DELETE_SELF | IN_MOVED_FROM |
+                                     IN_MOVED_TO | IN_CLOSE_WRITE;
+
+    std::string relative(const std::string &path) const {
+        return path.size() > root.size() ? path.substr(root.size() + 1) : "";
+    }
+
+    bool skipped(const std::string &dir) const {
+        if (dir == root)
+            return false;
+        std::string name = fs::path(dir).filename().string();
+        // mkc's own output and version control metadata
+        if (dir == root + "/build" || name == ".git" || name == ".hg" ||
+            name == ".svn")
+            return true;
+        return exclusions && exclusions->excluded_dir(relative(dir), name);
+    }
+
+    // sources and headers scan() would pick up, and anything else a source
+    // includes (.inl, .def, ...). directory removals and renames can take
+    // sources with them, so they always count.
+    bool relevant(const WatchEvent &ev, FlatMap<bool> &graph) const {
+        if (ev.mask & IN_Q_OVERFLOW)
+            return true;
+        if (ev.mask & IN_ISDIR)
+            return (ev.mask & (IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) &&
+                   !skipped(ev.path);
+
+        fs::path p = ev.path;
+        std::string name = p.filename().string();
+        std::string ext = p.extension().string();
+        std::string rel = relative(ev.path);
+        if (exclusions && exclusions->excluded_file(rel, name, ext))
+            return false;
+        if (ext == ".c" || ext == ".cc" || ext == ".cpp" || ext == ".h" ||
+            ext == ".hh" || ext == ".hpp")
+            return true;
+
+        PathId id = path_pool.find(ev.path);
+        if (id == NO_PATH)
+            return false;
+        if (graph.empty())
+            for (PathId inc : include_edges)
+                graph[inc] = true;
+        return graph.count(id);
+    }
+
+    void filter(std::vector<WatchEvent> &events) const {
+        FlatMap<bool> graph;
+        events.erase(std::remove_if(events.begin(), events.end(),
+                                    [&](const WatchEvent &ev) {
+                                        return !relevant(ev, graph);
+                                    }),
+                     events.end());
+    }
+
+    // watches `dir` and everything below it. with `found` set, files that
+    // already exist are reported as created: they may have been written
+    // before the watch was in place.
+    void add_tree(const std::string &dir, std::vector<WatchEvent> *found) {
+        if (skipped(dir) || wd_of_dir.count(dir))
+            return;
+        int wd = inotify_add_watch(fd, dir.c_str(), MASK | IN_ONLYDIR);
+        // ENOENT: removed since it was listed, its parent reports that
+        if (wd == -1 && errno == ENOENT)
+            return;
+        if (wd == -1) {
+            // ENOSPC (fs.inotify.max_user_watches) fails every directory
+            // after the first, one warning is enough
+            std::string msg = "can't watch \"" + dir +
+                              "\": " + std::strerror(errno);
+            if (missed)
+                Logger::debug(msg);
+            else
+                Logger::warningLog(msg + ", builds rescan everything");
+            missed = true;
+            return;
         }
-        fcntl(fd, F_SETFL, 0);
+        dir_of_wd[wd] = dir;
+        wd_of_dir[dir] = wd;
+
+        std::error_code ec;
+        for (fs::directory_iterator it(dir, ec), end; !ec && it != end;
+             it.increment(ec)) {
+            std::error_code sec;
+            if (it->is_symlink(sec))
+                continue;
+            if (it->is_directory(sec))
+                add_tree(it->path().string(), found);
+            else if (found)
+                found->push_back({it->path().string(), IN_CREATE});
+        }
+    }
+
+    // drops the watches of `dir` and of every directory below it
+    void remove_tree(const std::string &dir) {
+        std::string prefix = dir + "/";
+        for (auto it = wd_of_dir.begin(); it != wd_of_dir.end();) {
+            if (it->first == dir || it->first.rfind(prefix, 0) == 0) {
+                inotify_rm_watch(fd, it->second);
+                dir_of_wd.erase(it->second);
+                it = wd_of_dir.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void forget(int wd) {
+        auto it = dir_of_wd.find(wd);
+        if (it == dir_of_wd.end())
+            return;
+        wd_of_dir.erase(it->second);
+        dir_of_wd.erase(it);
+    }
+
+    void handle(const inotify_event *ev, std::vector<WatchEvent> &events) {
+        if (ev->mask & IN_Q_OVERFLOW) {
+            // events were dropped: rewatch everything, the build rescans
+            remove_tree(root);
+            missed = false;
+            add_tree(root, nullptr);
+            events.push_back({root, IN_Q_OVERFLOW});
+            return;
+        }
+        if (ev->mask & IN_IGNORED) {
+            forget(ev->wd);
+            return;
+        }
+        auto dir = dir_of_wd.find(ev->wd);
+        if (dir == dir_of_wd.end())
+            return;
+        std::string path =
+            ev->len > 0 ? dir->second + "/" + ev->name : dir->second;
+
+        if (ev->mask & IN_ISDIR) {
+            if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+                add_tree(path, &events);
+            else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+                remove_tree(path);
+        }
+        events.push_back({path, ev->mask});
     }
 
-    for (int wd : watches)
-        inotify_rm_watch(fd, wd);
-    close(fd);
-    return len > 0;
+    // reads what is queued; blocks for the first event if `block` is set.
+    bool read_events(std::vector<WatchEvent> &events, bool block) {
+        alignas(inotify_event) char buf[16384];
+        fcntl(fd, F_SETFL, block ? 0 : O_NONBLOCK);
+        while (true) {
+            ssize_t len = read(fd, buf, sizeof(buf));
+            if (len <= 0)
+                return !block;
+            for (ssize_t off = 0; off < len;) {
+                const auto *ev =
+                    reinterpret_cast<const inotify_event *>(buf + off);
+                handle(ev, events);
+                off += sizeof(inotify_event) + ev->len;
+            }
+            if (block)
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+            block = false;
+        }
+    }
+};
+
+FileWatcher watcher;
+
+bool poll_watcher(std::vector<WatchEvent> &fresh) {
+    return watcher.started() && watcher.poll(fresh);
+}
+
+bool closed_after_write(const WatchEvent &ev) {
+    return ev.mask & IN_CLOSE_WRITE;
 }
 
-bool file_watcher(const Config &config) { return watch(config.root_dir); }
+bool structural_change(const std::vector<WatchEvent> &events) {
+    for (const auto &ev : events)
+        if (ev.mask & (IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVED_FROM |
+                       IN_MOVED_TO | IN_Q_OVERFLOW | IN_ISDIR))
+            return true;
+    return false;
+}
+
+bool start_watcher(const Config &config) {
+    if (watcher.started())
+        return true;
+    // the same exclusions scan() applies
+    compile_exclusions(config);
+    return watcher.start(config.root_dir, exclusions);
+}
+
+bool watching() { return watcher.started() && watcher.complete(); }
+
+void take_watched(std::vector<WatchEvent> &events) {
+    events.clear();
+    if (!watcher.started())
+        return;
+    watcher.take(events);
+    if (has_entry_events(events))
+        invalidate_path_cache();
+}
+
+bool file_watcher(const Config &config, std::vector<WatchEvent> &events) {
+    if (!start_watcher(config))
+        return false;
+    if (!watcher.wait(events))
+        return false;
+    if (on_first_events)
+        on_first_events(config, events);
+    watcher.debounce(events);
+    if (has_entry_events(events))
+        invalidate_path_cache();
+    return true;
+}
 #else
 #include <iostream>
-bool file_watcher(const std::string &) {
+bool file_watcher(const Config &, std::vector<WatchEvent> &) {
     std::cerr << "\nfile-watch not implemented on this platform\n";
     return false;
 }
+
+bool structural_change(const std::vector<WatchEvent> &) { return true; }
+
+bool start_watcher(const Config &) { return false; }
+
+bool watching() { return false; }
+
+void take_watched(std::vector<WatchEvent> &events) { events.clear(); }
+
+bool poll_watcher(std::vector<WatchEvent> &) { return false; }
+
+bool closed_after_write(const WatchEvent &) { return false; }
 #endif
 #endif
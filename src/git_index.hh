@@ -0,0 +1,337 @@
+#ifndef GITINDEX_H_
+#define GITINDEX_H_
+#include "config.hh"
+#include "containers.hh"
+#include "helpers.hh"
+#include "logger.hh"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// with use_git_index on, files tracked by git are fingerprinted by the blob
+// id recorded in .git/index instead of being read. git keeps the stat data
+// of every tracked file next to its blob id; as long as the file's stat
+// still matches, its content is the blob's, so a clean checkout costs one
+// stat per file and the fingerprints are the same in every clone.
+//
+// anything the index can't vouch for (untracked, modified, racily clean,
+// conflicted, skip-worktree) falls back to reading the file and computing
+// its blob id the way git would, so a file has the same fingerprint
+// whichever way it was taken.
+
+struct GitIndexEntry {
+    uint32_t ctime_s = 0, ctime_ns = 0;
+    uint32_t mtime_s = 0, mtime_ns = 0;
+    uint32_t ino = 0;
+    uint32_t size = 0;
+    uint64_t blob = 0;
+};
+
+struct GitIndex {
+    fs::path index_path;
+    // stat signature of the index file when it was parsed
+    uint64_t size = 0, mtime = 0;
+    bool loaded = false;
+    // keyed by normalized absolute path
+    FlatMap<GitIndexEntry> entries;
+};
+
+GitIndex git_index;
+
+uint32_t git_be32(const unsigned char *p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+           (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+// sha-1 of `data`, 20 raw bytes
+std::string sha1(const std::string &data) {
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476,
+                     0xC3D2E1F0};
+    // padding: 0x80, zeros, then the length in bits, big endian
+    std::string msg = data;
+    msg.push_back('\x80');
+    while (msg.size() % 64 != 56)
+        msg.push_back('\0');
+    uint64_t bits = static_cast<uint64_t>(data.size()) * 8;
+    for (int i = 7; i >= 0; i--)
+        msg.push_back(static_cast<char>(bits >> (i * 8)));
+
+    auto rol = [](uint32_t x, int n) { return (x << n) | (x >> (32 - n)); };
+    const auto *p = reinterpret_cast<const unsigned char *>(msg.data());
+    for (size_t off = 0; off < msg.size(); off += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++)
+            w[i] = git_be32(p + off + i * 4);
+        for (int i = 16; i < 80; i++)
+            w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            uint32_t t = rol(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rol(b, 30);
+            b = a;
+            a = t;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    std::string digest;
+    for (uint32_t v : h)
+        for (int i = 3; i >= 0; i--)
+            digest.push_back(static_cast<char>(v >> (i * 8)));
+    return digest;
+}
+
+// the fingerprint git_fingerprint() would give `p` if the index vouched for
+// it: the blob id, sha-1 of "blob <len>\0" + content.
+uint64_t git_blob_hash(const fs::path &p) {
+    std::ifstream in(p, std::ios::binary);
+    if (!in) {
+        Logger::failLog("file does not exist: " + readable_path(p),
+                        " function: git_blob_hash() failed.");
+        return 0;
+    }
+    std::string content((std::istreambuf_iterator<char>(in)),
+                        std::istreambuf_iterator<char>());
+    std::string blob = "blob " + std::to_string(content.size());
+    blob.push_back('\0');
+    return hash_string(sha1(blob + content));
+}
+
+// finds the index of the repository `root` is in, following the
+// "gitdir: ..." indirection of worktrees and submodules.
+bool find_git_index(const fs::path &root, fs::path &work_tree,
+                    fs::path &git_dir) {
+    for (fs::path dir = normalize_fs_path(root); !dir.empty();
+         dir = dir.parent_path()) {
+        fs::path dot_git = dir / ".git";
+        std::error_code ec;
+        if (fs::is_directory(dot_git, ec)) {
+            work_tree = dir;
+            git_dir = dot_git;
+            return true;
+        }
+        if (fs::is_regular_file(dot_git, ec)) {
+            std::ifstream in(dot_git);
+            std::string line;
+            if (!std::getline(in, line) || line.rfind("gitdir: ", 0) != 0)
+                return false;
+            fs::path target = line.substr(8);
+            work_tree = dir;
+            git_dir = target.is_absolute() ? target : dir / target;
+            return true;
+        }
+        if (dir == dir.root_path())
+            break;
+    }
+    return false;
+}
+
+// the index only carries sha-1 sized ids here
+bool git_uses_sha256(const fs::path &git_dir) {
+    std::vector<fs::path> configs = {git_dir / "config"};
+    std::ifstream common(git_dir / "commondir");
+    std::string line;
+    if (std::getline(common, line) && !line.empty()) {
+        fs::path c = line;
+        configs.push_back((c.is_absolute() ? c : git_dir / c) / "config");
+    }
+    for (const auto &cfg : configs) {
+        std::ifstream in(cfg);
+        while (std::getline(in, line))
+            if (line.find("objectformat") != std::string::npos &&
+                line.find("sha256") != std::string::npos)
+                return true;
+    }
+    return false;
+}
+
+// parses index versions 2 to 4. returns false on anything unexpected, in
+// which case the index is simply not used.
+bool parse_git_index(const std::string &data, const fs::path &work_tree,
+                     uint64_t index_mtime) {
+    const auto *p = reinterpret_cast<const unsigned char *>(data.data());
+    const size_t n = data.size();
+    if (n < 12 + 20 || std::memcmp(p, "DIRC", 4) != 0)
+        return false;
+    uint32_t version = git_be32(p + 4);
+    uint32_t count = git_be32(p + 8);
+    if (version < 2 || version > 4)
+        return false;
+
+    const uint32_t idx_s = static_cast<uint32_t>(index_mtime / 1000000000ULL);
+    const uint32_t idx_ns = static_cast<uint32_t>(index_mtime % 1000000000ULL);
+    std::string prefix = normalize_path(work_tree) + "/";
+    std::string name;
+    size_t off = 12;
+    size_t racy = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        // ctime, mtime, dev, ino, mode, uid, gid, size, 20 byte id, flags
+        if (off + 62 > n)
+            return false;
+        const unsigned char *e = p + off;
+        GitIndexEntry entry;
+        entry.ctime_s = git_be32(e);
+        entry.ctime_ns = git_be32(e + 4);
+        entry.mtime_s = git_be32(e + 8);
+        entry.mtime_ns = git_be32(e + 12);
+        entry.ino = git_be32(e + 20);
+        entry.size = git_be32(e + 36);
+        entry.blob = hash_string(std::string(data, off + 40, 20));
+        uint16_t flags = static_cast<uint16_t>((e[60] << 8) | e[61]);
+        size_t header = 62;
+        bool skip_worktree = false;
+        if (flags & 0x4000) {
+            if (version < 3 || off + 64 > n)
+                return false;
+            skip_worktree = e[62] & 0x40;
+            header = 64;
+        }
+        size_t pos = off + header;
+
+        if (version == 4) {
+            // name is the previous one minus `strip` bytes, plus a suffix
+            size_t strip = 0;
+            unsigned char c;
+            if (pos >= n)
+                return false;
+            c = p[pos++];
+            strip = c & 127;
+            while (c & 128) {
+                if (pos >= n)
+                    return false;
+                strip++;
+                c = p[pos++];
+                strip = (strip << 7) + (c & 127);
+            }
+            if (strip > name.size())
+                return false;
+            const void *end = std::memchr(p + pos, '\0', n - pos);
+            if (!end)
+                return false;
+            size_t len = static_cast<const unsigned char *>(end) - (p + pos);
+            name.resize(name.size() - strip);
+            name.append(data, pos, len);
+            off = pos + len + 1;
+        } else {
+            const void *end = std::memchr(p + pos, '\0', n - pos);
+            if (!end)
+                return false;
+            size_t len = static_cast<const unsigned char *>(end) - (p + pos);
+            name.assign(data, pos, len);
+            // entries are NUL padded to a multiple of 8 bytes
+            off += (header + len + 8) & ~size_t(7);
+        }
+
+        // only stage 0 entries describe the working tree file
+        if ((flags & 0x3000) || skip_worktree)
+            continue;
+        // modified in the same tick the index was written: git itself
+        // can't tell from stat data whether it is clean
+        if (entry.mtime_s > idx_s ||
+            (entry.mtime_s == idx_s && entry.mtime_ns >= idx_ns)) {
+            racy++;
+            continue;
+        }
+        git_index.entries[path_pool.intern(prefix + name)] = entry;
+    }
+    if (racy)
+        Logger::debug("git index: " + std::to_string(racy) +
+                      " racily clean entries ignored");
+    return true;
+}
+
+// (re)reads the index if it changed since the last call, so watch mode
+// only pays for it after a commit, checkout or git add.
+void load_git_index(const Config &conf) {
+    fs::path work_tree, git_dir;
+    if (!find_git_index(conf.root_dir, work_tree, git_dir)) {
+        Logger::debug("git index: no repository found, hashing files");
+        git_index = GitIndex{};
+        return;
+    }
+
+    fs::path index_path = git_dir / "index";
+    uint64_t size = 0, mtime = 0;
+    if (!stat_signature(index_path, size, mtime)) {
+        git_index = GitIndex{};
+        return;
+    }
+    if (git_index.loaded && git_index.index_path == index_path &&
+        git_index.size == size && git_index.mtime == mtime)
+        return;
+
+    git_index = GitIndex{};
+    git_index.index_path = index_path;
+    git_index.size = size;
+    git_index.mtime = mtime;
+    if (git_uses_sha256(git_dir)) {
+        Logger::debug("git index: sha256 repositories are not supported");
+        return;
+    }
+
+    std::ifstream in(index_path, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(in)),
+                     std::istreambuf_iterator<char>());
+    if (!parse_git_index(data, work_tree, mtime)) {
+        Logger::debug("git index: failed to parse \"" + index_path.string() +
+                      "\", hashing files");
+        git_index.entries.clear();
+        return;
+    }
+    git_index.loaded = true;
+    Logger::debug("git index: " + std::to_string(git_index.entries.size()) +
+                  " tracked files");
+}
+
+// the fingerprint of `p` from the index, if the file is tracked and its
+// stat data still matches what git recorded.
+bool git_fingerprint(const fs::path &p, PathId id, uint64_t &hash) {
+    if (!git_index.loaded)
+        return false;
+    const GitIndexEntry *entry = git_index.entries.find(id);
+    if (!entry)
+        return false;
+
+    struct stat st;
+    if (::stat(p.c_str(), &st) != 0)
+        return false;
+    const GitIndexEntry &e = *entry;
+    if (e.mtime_s != static_cast<uint32_t>(st.st_mtim.tv_sec) ||
+        e.mtime_ns != static_cast<uint32_t>(st.st_mtim.tv_nsec) ||
+        e.ctime_s != static_cast<uint32_t>(st.st_ctim.tv_sec) ||
+        e.ctime_ns != static_cast<uint32_t>(st.st_ctim.tv_nsec) ||
+        e.ino != static_cast<uint32_t>(st.st_ino) ||
+        e.size != static_cast<uint32_t>(st.st_size))
+        return false;
+    hash = e.blob;
+    return true;
+}
+
+#endif
@@ -1,15 +1,50 @@
 #ifndef HELPERS_H_
 #define HELPERS_H_
 #include "config.hh"
+#include "paths.hh"
 #include <algorithm>
+#include <array>
+#include <cstdio>
 #include <filesystem>
 #include <fstream>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <sys/stat.h>
+#include <unordered_map>
+#include <vector>
 
 namespace fs = std::filesystem;
 
-// normalizes paths from "./logger.hh" into "logger.hh"
-std::string normalize_path(const fs::path &p) {
+// fs::weakly_canonical() stats every component of the path on every call.
+// the helpers below give the same result but memoize it: directories are
+// resolved one component at a time and cached, so a path costs at most one
+// lstat() for its own name, and nothing at all once seen. the caches only
+// go stale when entries are created, removed or renamed, which watch mode
+// reports through invalidate_path_cache().
+struct PathCache {
+    std::mutex lock;
+    // lexically normal absolute directory -> canonical form
+    std::unordered_map<std::string, std::string> dirs;
+    // arguments of normalize_path() and their results, each string stored
+    // once (an already normalized argument is its own result):
+    // normalized[id of argument] = id of result
+    PathInterner names;
+    std::vector<PathId> normalized;
+    std::string cwd;
+};
+
+PathCache path_cache;
+
+void invalidate_path_cache() {
+    std::lock_guard<std::mutex> l(path_cache.lock);
+    path_cache.dirs.clear();
+    path_cache.names = PathInterner{};
+    path_cache.normalized.clear();
+    path_cache.cwd.clear();
+}
+
+std::string uncached_canonical(const fs::path &p) {
     try {
         return fs::weakly_canonical(p).string();
     } catch (...) {
@@ -17,56 +52,133 @@ std::string normalize_path(const fs::path &p) {
     }
 }
 
-fs::path normalize_fs_path(const fs::path &p) {
+// `dir` + "/" + `name`, resolved if it is a symlink. callers hold the lock.
+std::string resolve_component(const std::string &dir, const std::string &name) {
+    std::string joined = dir == "/" ? "/" + name : dir + "/" + name;
+    struct stat st;
+    if (::lstat(joined.c_str(), &st) == 0 && S_ISLNK(st.st_mode))
+        return uncached_canonical(joined);
+    return joined;
+}
+
+// callers hold the lock
+const std::string &canonical_dir(const std::string &dir) {
+    auto it = path_cache.dirs.find(dir);
+    if (it != path_cache.dirs.end())
+        return it->second;
+    fs::path d(dir);
+    std::string result = dir;
+    if (d.has_relative_path()) {
+        std::string parent = canonical_dir(d.parent_path().string());
+        result = resolve_component(parent, d.filename().string());
+    }
+    return path_cache.dirs.emplace(dir, std::move(result)).first->second;
+}
+
+// normalizes paths from "./logger.hh" into "/abs/path/logger.hh"
+std::string normalize_path(const fs::path &p) {
+    std::lock_guard<std::mutex> l(path_cache.lock);
+    PathId arg = path_cache.names.intern(p.native());
+    if (arg < path_cache.normalized.size() &&
+        path_cache.normalized[arg] != NO_PATH)
+        return path_cache.names.str(path_cache.normalized[arg]);
+
+    std::string result;
     try {
-        return fs::weakly_canonical(p);
+        if (path_cache.cwd.empty())
+            path_cache.cwd = fs::current_path().string();
+        fs::path abs = (p.is_absolute() ? p : fs::path(path_cache.cwd) / p)
+                           .lexically_normal();
+        std::string name = abs.filename().string();
+        // ".." has to be applied after resolving symlinks, leave that case
+        // (and trailing slashes) to the library
+        bool dotdot = false;
+        for (const auto &part : abs)
+            dotdot |= part == "..";
+        if (dotdot || name.empty() || !abs.has_relative_path())
+            result = uncached_canonical(p);
+        else
+            result = resolve_component(
+                canonical_dir(abs.parent_path().string()), name);
     } catch (...) {
-        return p;
+        result = p.string();
     }
+    PathId id = path_cache.names.intern(result);
+    path_cache.normalized.resize(path_cache.names.size(), NO_PATH);
+    path_cache.normalized[arg] = id;
+    // normalizing is idempotent
+    path_cache.normalized[id] = id;
+    return result;
 }
 
+fs::path normalize_fs_path(const fs::path &p) { return normalize_path(p); }
+
 // relative instead of absolute for readability in the logs
 std::string readable_path(const fs::path &p) {
     try {
-        return fs::relative(p, fs::current_path()).string();
+        fs::path base = normalize_path(".");
+        std::string rel =
+            fs::path(normalize_path(p)).lexically_relative(base).string();
+        return rel.empty() ? p.string() : rel;
     } catch (...) {
         return p.string();
     }
 }
 
-bool is_under(const fs::path &p, const fs::path &dir) {
-    auto canon_p = fs::weakly_canonical(p);
-    auto canon_d = fs::weakly_canonical(dir);
-    return std::mismatch(canon_d.begin(), canon_d.end(), canon_p.begin())
-               .first == canon_d.end();
+uint64_t hash_string(const std::string &s,
+                     uint64_t h = 1469598103934665603ULL) {
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
 }
 
-bool is_excluded(const Config &conf, const fs::path &path,
-                 const std::string &ext) {
-    if (conf.exclude_dirs.size() != 0) {
-        bool excluded = false;
-        for (const auto &excl : conf.exclude_dirs) {
-            fs::path excl_path = fs::path(excl);
-            if (path.filename() == excl_path.filename()) {
-                excluded = true;
-                break;
-            }
-            if (fs::is_directory(excl_path) &&
-                is_under(path, fs::path(conf.root_dir) / excl_path)) {
-                excluded = true;
-                break;
-            }
-        }
-        if (excluded)
-            return true;
-    }
-    if (conf.exclude_exts.size() != 0) {
-        if (std::find(conf.exclude_exts.begin(), conf.exclude_exts.end(),
-                      ext) != conf.exclude_exts.end())
-            return true;
+std::string cmd_output(const std::string &cmd) {
+    if (cmd.empty())
+        throw std::runtime_error("cmd_output(): empty command");
+
+    std::array<char, 256> buffer{};
+    std::string result;
+
+    FILE *pipe = popen(cmd.c_str(), "r");
+    if (!pipe)
+        throw std::runtime_error("cmd_output(): popen failed for command: " +
+                                 cmd);
+
+    while (fgets(buffer.data(), buffer.size(), pipe)) {
+        result += buffer.data();
     }
 
-    return false;
+    int rc = pclose(pipe);
+    if (rc == -1)
+        throw std::runtime_error("cmd_output(): pclose failed");
+    if (rc != 0)
+        throw std::runtime_error("cmd_output(): command returned non-zero: " +
+                                 cmd);
+    if (result.empty())
+        throw std::runtime_error("cmd_output(): command produced no output: " +
+                                 cmd);
+
+    return result;
+}
+
+// size and mtime (ns) of `p`, in one stat() call.
+bool stat_signature(const fs::path &p, uint64_t &size, uint64_t &mtime) {
+    struct stat st;
+    if (::stat(p.c_str(), &st) != 0)
+        return false;
+    size = static_cast<uint64_t>(st.st_size);
+    mtime = static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000ULL +
+            static_cast<uint64_t>(st.st_mtim.tv_nsec);
+    return true;
+}
+
+bool is_under(const fs::path &p, const fs::path &dir) {
+    fs::path canon_p = normalize_path(p);
+    fs::path canon_d = normalize_path(dir);
+    return std::mismatch(canon_d.begin(), canon_d.end(), canon_p.begin())
+               .first == canon_d.end();
 }
 
 #endif
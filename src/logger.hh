@@ -71,6 +71,17 @@ class Logger {
         f_flush(force_f);
     }
 
+    // raw compiler output, printed as-is below the log line that owns it.
+    static void printDiagnostics(const std::string &text) {
+        if (vb == Verbosity::silent || text.empty())
+            return;
+        size_t end = text.find_last_not_of('\n');
+        if (end == std::string::npos)
+            return;
+        std::cout << "\n" << text.substr(0, end + 1);
+        f_flush(force_f);
+    }
+
     static void printLogfile(const std::string &logfile_path,
                              const Config &conf) {
         if (vb == Verbosity::silent)
@@ -113,14 +124,14 @@ class Logger {
             std::cout << BLUE << "\n######## sources ########" << RESET
                       << std::endl;
             for (const auto &[_, src] : sources) {
-                std::cout << "  \"" << readable_path(src.path) << "\", "
+                std::cout << "  \"" << source_path(src) << "\", "
                           << std::endl;
             }
             if (!headers.empty()) {
                 std::cout << BLUE << "\n######## headers ########" << RESET
                           << std::endl;
-                for (const auto &[_, hdr] : headers) {
-                    std::cout << "  \"" << readable_path(hdr.path) << "\", "
+                for (const auto &[id, _] : headers) {
+                    std::cout << "  \"" << relative_path(id) << "\", "
                               << std::endl;
                 }
             }
@@ -131,7 +142,7 @@ class Logger {
                 std::string num = std::to_string(i);
                 std::cout << "[" << BLUE << num << RESET << "]"
                           << std::string(width - num.length(), ' ') << " "
-                          << readable_path(src.path) << std::endl;
+                          << source_path(src) << std::endl;
                 i++;
             }
             std::cout << "[" << CYAN << "LOG" << RESET << "] " << " " << (i - 1)
@@ -139,11 +150,11 @@ class Logger {
             if (!headers.empty()) {
                 std::cout << "[" << CYAN << "headers" << RESET << "] "
                           << std::endl;
-                for (const auto &[_, hdr] : headers) {
+                for (const auto &[id, _] : headers) {
                     std::string num = std::to_string(j);
                     std::cout << "[" << BLUE << num << RESET << "]"
                               << std::string(width - num.length(), ' ') << " "
-                              << readable_path(hdr.path) << std::endl;
+                              << relative_path(id) << std::endl;
                     j++;
                 }
                 std::cout << "[" << CYAN << "LOG" << RESET << "] " << " "
@@ -1,7 +1,7 @@
 #include "benchmark.hh"
 #include "build_procedure.hh"
 #include "cli.hh"
-#include "file_watch.hh"
+#include "daemon.hh"
 #include "parse_config.hh"
 #include "pkg_config.hh"
 
@@ -24,41 +24,41 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
-    if (!config.config_file.empty()) {
-        try {
-            load_toml_config(config.config_file, config);
-        } catch (const std::exception &e) {
-            Logger::failLog("No config detected: proceeding with defaults.",
-                            e.what());
-        } catch (...) {
-            std::cout << std::endl;
-            return 1;
-        }
-    };
+    // a running daemon answers from memory
+    int status = 0;
+    if (!config.daemon_mode && !config.watch_mode && !config.dry_run &&
+        !config.warnings_summary &&
+        forward_to_daemon(config, argc, argv, status))
+        return status;
 
-    Logger::set_log_verbosity(config.log_verbosity);
-    Logger::set_log_immediacy(config.log_immediately);
+    if (!finish_config(config))
+        return 1;
 
-    for (auto &p : config.include_dirs)
-        normalize_fs_path(p);
-    for (auto &p : config.exclude_dirs)
-        normalize_fs_path(p);
-    if (config.unity_b)
-        config.exclude_dirs.push_back(fs::weakly_canonical("build"));
+    if (config.daemon_mode)
+        return run_daemon(config, argc, argv);
 
     if (config.watch_mode) {
         Logger::warningLog("Watching for changes on root directory: \"" +
                            config.root_dir + "\"");
         std::cout.flush();
+        std::vector<WatchEvent> events;
+        if (config.speculative)
+            on_first_events = speculate;
+        // once per session, the flags are appended to config
+        try {
+            resolve_pkg_config(config);
+        } catch (...) {
+            std::cout << std::endl;
+            return 1;
+        }
         while (true) {
-            if (file_watcher(config)) {
+            if (file_watcher(config, events)) {
                 try {
                     std::unique_ptr<BuildTimer> timer;
                     if (config.benchmark)
                         timer = std::make_unique<BuildTimer>(
                             "finished in: ", config.benchmark_msg.c_str());
-                    resolve_pkg_config(config);
-                    build_procedure(config);
+                    incremental_build(config, events);
                 } catch (...) {
                     std::cout << std::endl;
                     return 1;
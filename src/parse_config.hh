@@ -42,10 +42,34 @@ void load_toml_config(const fs::path &path, Config &config) {
                 }
             }
 
+        if (auto n = project->get("unity_chunks"))
+            if (auto v = n->value<int64_t>())
+                config.unity_chunk_count = static_cast<int>(*v);
+
+        if (auto n = project->get("unity_chunk_size"))
+            if (auto v = n->value<int64_t>())
+                config.unity_chunk_bytes = static_cast<uint64_t>(*v);
+
+        if (auto n = project->get("unity_adaptive"))
+            if (auto v = n->value<bool>())
+                config.unity_adaptive = *v;
+
         if (auto n = project->get("shared"))
             if (auto v = n->value<bool>())
                 config.make_shared = *v;
 
+        if (auto n = project->get("track_external_headers"))
+            if (auto v = n->value<bool>())
+                config.track_external_headers = *v;
+
+        if (auto n = project->get("token_header_hash"))
+            if (auto v = n->value<bool>())
+                config.token_header_hash = *v;
+
+        if (auto n = project->get("git_index"))
+            if (auto v = n->value<bool>())
+                config.use_git_index = *v;
+
         if (auto arr = project->get("compile_flags"); arr && arr->is_array())
             for (auto &&v : *arr->as_array())
                 if (auto s = v.value<std::string>())
@@ -114,9 +138,39 @@ void load_toml_config(const fs::path &path, Config &config) {
                 if (auto s = v.value<std::string>())
                     config.pkg_deps.push_back({*s});
         }
+        if (auto n = pkg->get("static"))
+            if (auto v = n->value<bool>())
+                config.pkg_static = *v;
     }
 }
 
+// everything after the command line: the toml file on top of it, logger
+// settings and path cleanup. false if the build should not go on.
+bool finish_config(Config &config) {
+    if (!config.config_file.empty()) {
+        try {
+            load_toml_config(config.config_file, config);
+        } catch (const std::exception &e) {
+            Logger::failLog("No config detected: proceeding with defaults.",
+                            e.what());
+        } catch (...) {
+            std::cout << std::endl;
+            return false;
+        }
+    };
+
+    Logger::set_log_verbosity(config.log_verbosity);
+    Logger::set_log_immediacy(config.log_immediately);
+
+    for (auto &p : config.include_dirs)
+        normalize_fs_path(p);
+    for (auto &p : config.exclude_dirs)
+        normalize_fs_path(p);
+    if (config.unity_b)
+        config.exclude_dirs.push_back(fs::weakly_canonical("build"));
+    return true;
+}
+
 void generate_example_config(const fs::path &path) {
     if (fs::exists(path)) {
         Logger::failLog(
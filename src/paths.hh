@@ -0,0 +1,206 @@
+#ifndef PATHS_H_
+#define PATHS_H_
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// every normalized path mkc deals with is stored once, in one arena, and
+// referred to by a 32-bit id everywhere else. ids are dense and never
+// reused, so per-file tables can be keyed by them instead of by strings.
+// not thread safe: paths are interned from the main thread only.
+
+using PathId = uint32_t;
+constexpr PathId NO_PATH = UINT32_MAX;
+
+inline uint64_t path_hash(std::string_view s) {
+    uint64_t h = 1469598103934665603ULL;
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+class PathInterner {
+  public:
+    PathId intern(std::string_view s) {
+        uint64_t h = path_hash(s);
+        size_t slot = probe(s, h);
+        if (slots[slot] != 0)
+            return slots[slot] - 1;
+
+        PathId id = static_cast<PathId>(hashes.size());
+        arena.append(s);
+        offsets.push_back(static_cast<uint32_t>(arena.size()));
+        hashes.push_back(h);
+        slots[slot] = id + 1;
+        if (hashes.size() * 4 >= slots.size() * 3)
+            grow();
+        return id;
+    }
+
+    // NO_PATH if `s` was never interned
+    PathId find(std::string_view s) const {
+        size_t slot = probe(s, path_hash(s));
+        return slots[slot] == 0 ? NO_PATH : slots[slot] - 1;
+    }
+
+    // valid until the next intern()
+    std::string_view view(PathId id) const {
+        return std::string_view(arena).substr(offsets[id],
+                                              offsets[id + 1] - offsets[id]);
+    }
+
+    std::string str(PathId id) const { return std::string(view(id)); }
+
+    size_t size() const { return hashes.size(); }
+
+  private:
+    std::string arena;
+    // path `id` is arena[offsets[id], offsets[id + 1])
+    std::vector<uint32_t> offsets{0};
+    std::vector<uint64_t> hashes;
+    // open addressing, linear probing; id + 1, 0 for an empty slot
+    std::vector<uint32_t> slots = std::vector<uint32_t>(1024, 0);
+
+    size_t probe(std::string_view s, uint64_t h) const {
+        size_t mask = slots.size() - 1;
+        size_t slot = h & mask;
+        while (slots[slot] != 0) {
+            PathId id = slots[slot] - 1;
+            if (hashes[id] == h && view(id) == s)
+                break;
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    void grow() {
+        std::vector<uint32_t> old(slots.size() * 2, 0);
+        slots.swap(old);
+        size_t mask = slots.size() - 1;
+        for (PathId id = 0; id < hashes.size(); id++) {
+            size_t slot = hashes[id] & mask;
+            while (slots[slot] != 0)
+                slot = (slot + 1) & mask;
+            slots[slot] = id + 1;
+        }
+    }
+};
+
+PathInterner path_pool;
+
+// a map keyed by PathId: the entries live in one dense vector (iterated in
+// insertion order) and an open-addressing table of indices points into it.
+template <typename V> class FlatMap {
+  public:
+    using value_type = std::pair<PathId, V>;
+    using iterator = typename std::vector<value_type>::iterator;
+    using const_iterator = typename std::vector<value_type>::const_iterator;
+
+    V *find(PathId id) {
+        size_t slot = probe(id);
+        return slots[slot] == 0 ? nullptr : &items[slots[slot] - 1].second;
+    }
+    const V *find(PathId id) const {
+        size_t slot = probe(id);
+        return slots[slot] == 0 ? nullptr : &items[slots[slot] - 1].second;
+    }
+    bool count(PathId id) const { return find(id) != nullptr; }
+
+    V &operator[](PathId id) {
+        size_t slot = probe(id);
+        if (slots[slot] != 0)
+            return items[slots[slot] - 1].second;
+        items.emplace_back(id, V{});
+        slots[slot] = static_cast<uint32_t>(items.size());
+        if (items.size() * 4 >= slots.size() * 3)
+            rehash(slots.size() * 2);
+        return items.back().second;
+    }
+
+    // moves the last entry into the erased one's place, so erasing while
+    // iterating is not supported.
+    bool erase(PathId id) {
+        size_t slot = probe(id);
+        if (slots[slot] == 0)
+            return false;
+        uint32_t index = slots[slot] - 1;
+        if (index + 1 != items.size()) {
+            size_t moved = probe(items.back().first);
+            items[index] = std::move(items.back());
+            slots[moved] = index + 1;
+        }
+        items.pop_back();
+        // backward shift deletion keeps probe sequences unbroken
+        size_t mask = slots.size() - 1;
+        size_t hole = slot;
+        for (size_t next = (hole + 1) & mask; slots[next] != 0;
+             next = (next + 1) & mask) {
+            size_t home = ideal(items[slots[next] - 1].first);
+            if (((next - home) & mask) >= ((next - hole) & mask)) {
+                slots[hole] = slots[next];
+                hole = next;
+            }
+        }
+        slots[hole] = 0;
+        return true;
+    }
+
+    void clear() {
+        items.clear();
+        slots.assign(16, 0);
+    }
+    void reserve(size_t n) {
+        items.reserve(n);
+        size_t want = 16;
+        while (want * 3 <= n * 4)
+            want *= 2;
+        if (want > slots.size())
+            rehash(want);
+    }
+
+    size_t size() const { return items.size(); }
+    bool empty() const { return items.empty(); }
+    iterator begin() { return items.begin(); }
+    iterator end() { return items.end(); }
+    const_iterator begin() const { return items.begin(); }
+    const_iterator end() const { return items.end(); }
+
+  private:
+    std::vector<value_type> items;
+    std::vector<uint32_t> slots = std::vector<uint32_t>(16, 0);
+
+    size_t ideal(PathId id) const {
+        // ids are sequential, spread them over the table
+        return (static_cast<uint64_t>(id) * 11400714819323198485ULL >> 32) &
+               (slots.size() - 1);
+    }
+
+    size_t probe(PathId id) const {
+        size_t mask = slots.size() - 1;
+        size_t slot = ideal(id);
+        while (slots[slot] != 0 && items[slots[slot] - 1].first != id)
+            slot = (slot + 1) & mask;
+        return slot;
+    }
+
+    void rehash(size_t n) {
+        slots.assign(n, 0);
+        for (uint32_t i = 0; i < items.size(); i++)
+            slots[probe(items[i].first)] = i + 1;
+    }
+};
+
+// a contiguous run of ids, e.g. one row of the include graph
+struct PathIdRange {
+    const PathId *first = nullptr;
+    const PathId *last = nullptr;
+    const PathId *begin() const { return first; }
+    const PathId *end() const { return last; }
+    size_t size() const { return last - first; }
+};
+
+#endif
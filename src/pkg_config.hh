@@ -1,53 +1,643 @@
 #ifndef PKGCONF_H_
 #define PKGCONF_H_
 #include "config.hh"
+#include "exceptions.hh"
+#include "helpers.hh"
 #include "logger.hh"
-#include <array>
+#include "toolchain.hh"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <sstream>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
-std::string cmd_output(const std::string &cmd) {
-    if (cmd.empty())
-        throw std::runtime_error("cmd_output(): empty command");
+// the search path of a stock pkg-config, for when there is no pkg-config
+// to ask
+#define DEFAULT_PC_PATH                                                        \
+    "/usr/local/lib/pkgconfig:/usr/local/share/pkgconfig:/usr/lib/pkgconfig:"  \
+    "/usr/share/pkgconfig"
 
-    std::array<char, 256> buffer{};
-    std::string result;
+// the flags of [pkg].deps. they are resolved by reading the .pc files
+// directly, with pkg-config as the fallback, and the result is cached in
+// "build/.pkgconfig", keyed by the dependency list, the pkg-config
+// environment and binary, and the stat signatures of the search directories
+// and of every .pc file in the dependency closure.
+struct PkgResolution {
+    std::string deps;
+    std::string env;
+    fs::path binary;
+    uint64_t size = 0;
+    uint64_t mtime = 0;
+    // built into pkg-config: the default search path, and the directories
+    // whose -I/-L flags it leaves out
+    std::string pc_path;
+    std::string system_includedirs = "/usr/include";
+    std::string system_libdirs = "/usr/lib:/lib";
+    struct Signed {
+        fs::path path;
+        uint64_t size = 0;
+        uint64_t mtime = 0;
+    };
+    // search directories (a new .pc file can shadow a known one) and the
+    // .pc files that were read
+    std::vector<Signed> inputs;
+    std::vector<std::string> cflags;
+    std::vector<std::string> libs;
+    bool loaded = false;
+};
 
-    FILE *pipe = popen(cmd.c_str(), "r");
-    if (!pipe)
-        throw std::runtime_error("cmd_output(): popen failed for command: " +
-                                 cmd);
+PkgResolution pkg_resolution;
 
-    while (fgets(buffer.data(), buffer.size(), pipe)) {
-        result += buffer.data();
+// records the signature of `p` as an input of `res`. taken before the file
+// is read, so an edit in between invalidates the result.
+void sign_input(const fs::path &p, PkgResolution &res) {
+    PkgResolution::Signed s{p};
+    // a directory that doesn't exist yet is recorded as 0 0
+    stat_signature(p, s.size, s.mtime);
+    res.inputs.push_back(s);
+}
+
+std::string pkg_config_env() {
+    std::string env;
+    for (const char *var :
+         {"PKG_CONFIG_PATH", "PKG_CONFIG_LIBDIR", "PKG_CONFIG_SYSROOT_DIR",
+          "PKG_CONFIG_SYSTEM_INCLUDE_PATH", "PKG_CONFIG_SYSTEM_LIBRARY_PATH",
+          "PKG_CONFIG_ALLOW_SYSTEM_CFLAGS", "PKG_CONFIG_ALLOW_SYSTEM_LIBS"}) {
+        const char *v = std::getenv(var);
+        env += std::string(var) + "=" + (v ? v : "") + ";";
     }
+    return env;
+}
 
-    int rc = pclose(pipe);
-    if (rc == -1)
-        throw std::runtime_error("cmd_output(): pclose failed");
-    if (rc != 0)
-        throw std::runtime_error("cmd_output(): command returned non-zero: " +
-                                 cmd);
-    if (result.empty())
-        throw std::runtime_error("cmd_output(): command produced no output: " +
-                                 cmd);
+void split_search_path(const char *list, std::vector<fs::path> &dirs) {
+    std::istringstream iss(list ? list : "");
+    for (std::string dir; std::getline(iss, dir, ':');)
+        if (!dir.empty())
+            dirs.emplace_back(dir);
+}
 
-    return result;
+// where pkg-config looks, in order: PKG_CONFIG_PATH, then PKG_CONFIG_LIBDIR
+// if set, or the built-in path otherwise
+std::vector<fs::path> pc_search_dirs(const std::string &pc_path) {
+    std::vector<fs::path> dirs;
+    split_search_path(std::getenv("PKG_CONFIG_PATH"), dirs);
+    if (const char *libdir = std::getenv("PKG_CONFIG_LIBDIR"))
+        split_search_path(libdir, dirs);
+    else
+        split_search_path(pc_path.c_str(), dirs);
+    return dirs;
 }
 
-void resolve_pkg_config(Config &conf) {
-    if (conf.pkg_deps.empty())
-        return;
+fs::path find_pc_file(const std::string &name,
+                      const std::vector<fs::path> &dirs) {
+    if (name.size() > 3 && name.compare(name.size() - 3, 3, ".pc") == 0)
+        return fs::exists(name) ? fs::path(name) : fs::path();
+    for (const auto &dir : dirs) {
+        fs::path p = dir / (name + ".pc");
+        if (fs::exists(p))
+            return p;
+    }
+    return {};
+}
 
-    std::string dep_list;
-    for (auto &d : conf.pkg_deps) {
-        if (d.name.empty()) {
-            Logger::failLog("empty pkg-config dependency name",
-                            "failed at: resolve_pkg_config()");
-            throw "failed while resolving pkg-config";
+// one parsed .pc file: its variables and its fields, field names lowercased
+struct PcFile {
+    fs::path path;
+    std::unordered_map<std::string, std::string> vars;
+    std::unordered_map<std::string, std::string> fields;
+};
+
+// ${name} references, expanded recursively
+std::string expand_pc_vars(const std::string &value, const PcFile &pc,
+                           int depth = 0) {
+    if (depth > 32)
+        return value;
+    std::string out;
+    for (size_t i = 0; i < value.size(); i++) {
+        if (value[i] == '$' && i + 1 < value.size() && value[i + 1] == '$') {
+            out += '$';
+            i++;
+            continue;
         }
-        dep_list += d.name + " ";
+        size_t close = value.find('}', i);
+        if (value.compare(i, 2, "${") != 0 || close == std::string::npos) {
+            out += value[i];
+            continue;
+        }
+        auto var = pc.vars.find(value.substr(i + 2, close - i - 2));
+        if (var != pc.vars.end())
+            out += expand_pc_vars(var->second, pc, depth + 1);
+        i = close;
     }
+    return out;
+}
+
+bool load_pc_file(const fs::path &path, PcFile &pc) {
+    std::ifstream in(path);
+    if (!in)
+        return false;
+    pc = PcFile{};
+    pc.path = path;
+    pc.vars["pcfiledir"] = path.parent_path().string();
+
+    std::string line;
+    for (std::string part; std::getline(in, part);) {
+        // a trailing backslash continues the line
+        if (!part.empty() && part.back() == '\\') {
+            part.pop_back();
+            line += part;
+            continue;
+        }
+        line += part;
+        std::string entry = std::move(line);
+        line.clear();
+
+        size_t hash = entry.find('#');
+        if (hash != std::string::npos)
+            entry.erase(hash);
+        size_t sep = entry.find_first_of(":=");
+        if (sep == std::string::npos)
+            continue;
+        std::string key = entry.substr(0, sep);
+        std::string value = entry.substr(sep + 1);
+        auto trim = [](std::string &str) {
+            str.erase(0, str.find_first_not_of(" \t\r"));
+            str.erase(str.find_last_not_of(" \t\r") + 1);
+        };
+        trim(key);
+        trim(value);
+        if (key.empty() || key.find_first_of(" \t") != std::string::npos)
+            continue;
+        if (entry[sep] == '=') {
+            pc.vars[key] = value;
+        } else {
+            for (char &c : key)
+                c = std::tolower(static_cast<unsigned char>(c));
+            pc.fields[key] = expand_pc_vars(value, pc);
+        }
+    }
+    return true;
+}
+
+std::string pc_field(const PcFile &pc, const std::string &name) {
+    auto it = pc.fields.find(name);
+    return it == pc.fields.end() ? "" : it->second;
+}
+
+// one entry of a Requires: list
+struct PcRequire {
+    std::string name;
+    std::string op;
+    std::string version;
+};
+
+// "a, b >= 1.2 c" -> a, b (>= 1.2), c
+std::vector<PcRequire> parse_requires(const std::string &value) {
+    std::vector<std::string> toks;
+    const std::string ops = "<>=!";
+    for (size_t i = 0; i < value.size();) {
+        char c = value[i];
+        if (c == ' ' || c == '\t' || c == ',') {
+            i++;
+            continue;
+        }
+        bool op = ops.find(c) != std::string::npos;
+        size_t j = i;
+        while (j < value.size() && value[j] != ' ' && value[j] != '\t' &&
+               value[j] != ',' &&
+               (ops.find(value[j]) != std::string::npos) == op)
+            j++;
+        toks.push_back(value.substr(i, j - i));
+        i = j;
+    }
+
+    std::vector<PcRequire> reqs;
+    for (size_t i = 0; i < toks.size(); i++) {
+        if (ops.find(toks[i][0]) != std::string::npos) {
+            if (!reqs.empty() && i + 1 < toks.size()) {
+                reqs.back().op = toks[i];
+                reqs.back().version = toks[++i];
+            }
+            continue;
+        }
+        reqs.push_back({toks[i], "", ""});
+    }
+    return reqs;
+}
+
+// rpm-style: runs of digits compare as numbers, runs of letters as text,
+// and a number beats text
+int compare_versions(const std::string &a, const std::string &b) {
+    size_t i = 0, j = 0;
+    while (true) {
+        while (i < a.size() && !std::isalnum(static_cast<unsigned char>(a[i])))
+            i++;
+        while (j < b.size() && !std::isalnum(static_cast<unsigned char>(b[j])))
+            j++;
+        if (i >= a.size() || j >= b.size())
+            return (i < a.size()) - (j < b.size());
+
+        bool num = std::isdigit(static_cast<unsigned char>(a[i]));
+        bool b_num = std::isdigit(static_cast<unsigned char>(b[j]));
+        if (num != b_num)
+            return num ? 1 : -1;
+        auto run = [num](const std::string &s, size_t &k) {
+            size_t from = k;
+            while (k < s.size() &&
+                   (num ? std::isdigit(static_cast<unsigned char>(s[k]))
+                        : std::isalpha(static_cast<unsigned char>(s[k]))))
+                k++;
+            std::string seg = s.substr(from, k - from);
+            if (num) {
+                seg.erase(0, seg.find_first_not_of('0'));
+            }
+            return seg;
+        };
+        std::string sa = run(a, i), sb = run(b, j);
+        if (num && sa.size() != sb.size())
+            return sa.size() < sb.size() ? -1 : 1;
+        if (int c = sa.compare(sb))
+            return c < 0 ? -1 : 1;
+    }
+}
+
+bool version_satisfies(const std::string &have, const PcRequire &req) {
+    if (req.op.empty())
+        return true;
+    int c = compare_versions(have, req.version);
+    if (req.op == "=")
+        return c == 0;
+    if (req.op == "!=")
+        return c != 0;
+    if (req.op == "<")
+        return c < 0;
+    if (req.op == "<=")
+        return c <= 0;
+    if (req.op == ">")
+        return c > 0;
+    if (req.op == ">=")
+        return c >= 0;
+    return false;
+}
+
+// splits a Cflags:/Libs: value the way a shell would, minus expansion
+std::vector<std::string> split_pc_flags(const std::string &value) {
+    std::vector<std::string> flags;
+    std::string cur;
+    bool in_word = false;
+    char quote = 0;
+    for (size_t i = 0; i < value.size(); i++) {
+        char c = value[i];
+        if (quote) {
+            if (c == quote)
+                quote = 0;
+            else
+                cur += c;
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+            in_word = true;
+        } else if (c == '\\' && i + 1 < value.size()) {
+            cur += value[++i];
+            in_word = true;
+        } else if (std::isspace(static_cast<unsigned char>(c))) {
+            if (in_word)
+                flags.push_back(cur);
+            cur.clear();
+            in_word = false;
+        } else {
+            cur += c;
+            in_word = true;
+        }
+    }
+    if (in_word)
+        flags.push_back(cur);
+    return flags;
+}
+
+// every .pc file `names` pull in through Requires and Requires.private
+std::vector<fs::path> pc_closure(const std::vector<std::string> &names,
+                                 const std::vector<fs::path> &dirs) {
+    std::vector<fs::path> files;
+    std::vector<std::string> todo;
+    for (const auto &name : names)
+        for (auto &req : parse_requires(name))
+            todo.push_back(req.name);
+    std::vector<std::string> seen;
+    while (!todo.empty()) {
+        std::string name = todo.back();
+        todo.pop_back();
+        if (std::find(seen.begin(), seen.end(), name) != seen.end())
+            continue;
+        seen.push_back(name);
+        fs::path path = find_pc_file(name, dirs);
+        PcFile pc;
+        if (path.empty() || !load_pc_file(path, pc))
+            continue;
+        files.push_back(path);
+        for (const char *key : {"requires", "requires.private"})
+            for (auto &req : parse_requires(pc_field(pc, key)))
+                todo.push_back(req.name);
+    }
+    return files;
+}
+
+// pkg-config without the process: the flags of `names` and everything they
+// require, from the built-in paths in `res` into res.cflags and res.libs.
+// cflags come from the whole Requires + Requires.private closure, libs from
+// the Requires closure, or with `static_link` from both plus Libs.private.
+// packages come before the packages they require. false if a package is
+// missing or a version constraint fails, pkg-config then reports it.
+bool resolve_pc_native(const std::vector<std::string> &names,
+                       bool static_link, PkgResolution &res) {
+    std::vector<fs::path> dirs = pc_search_dirs(res.pc_path);
+    std::unordered_map<std::string, PcFile> pcs;
+    auto load = [&](const PcRequire &req) -> const PcFile * {
+        auto it = pcs.find(req.name);
+        if (it == pcs.end()) {
+            fs::path path = find_pc_file(req.name, dirs);
+            PcFile pc;
+            if (path.empty())
+                return nullptr;
+            sign_input(path, res);
+            if (!load_pc_file(path, pc))
+                return nullptr;
+            it = pcs.emplace(req.name, std::move(pc)).first;
+        }
+        if (!version_satisfies(pc_field(it->second, "version"), req))
+            return nullptr;
+        return &it->second;
+    };
+
+    // post-order over the chosen edges, reversed: dependents first
+    auto order = [&](bool with_private, std::vector<const PcFile *> &out) {
+        std::unordered_set<std::string> done;
+        std::function<bool(const PcRequire &)> visit =
+            [&](const PcRequire &req) {
+                const PcFile *pc = load(req);
+                if (!pc)
+                    return false;
+                if (!done.insert(req.name).second)
+                    return true;
+                std::vector<PcRequire> reqs =
+                    parse_requires(pc_field(*pc, "requires"));
+                if (with_private) {
+                    auto priv =
+                        parse_requires(pc_field(*pc, "requires.private"));
+                    reqs.insert(reqs.end(), priv.begin(), priv.end());
+                }
+                // in reverse too, the list keeps its order once reversed
+                for (auto it = reqs.rbegin(); it != reqs.rend(); ++it)
+                    if (!visit(*it))
+                        return false;
+                out.push_back(pc);
+                return true;
+            };
+        // [pkg].deps entries may carry constraints, "zlib >= 1.2"
+        std::vector<PcRequire> roots;
+        for (const auto &name : names)
+            for (auto &req : parse_requires(name))
+                roots.push_back(req);
+        for (auto it = roots.rbegin(); it != roots.rend(); ++it)
+            if (!visit(*it))
+                return false;
+        std::reverse(out.begin(), out.end());
+        return true;
+    };
+
+    std::vector<const PcFile *> cflag_order, lib_order;
+    if (!order(true, cflag_order) || !order(static_link, lib_order))
+        return false;
+
+    const char *sysroot_c = std::getenv("PKG_CONFIG_SYSROOT_DIR");
+    std::string sysroot = sysroot_c ? sysroot_c : "";
+    auto system_dirs = [](const char *env, const std::string &builtin) {
+        std::vector<fs::path> dirs;
+        const char *v = std::getenv(env);
+        split_search_path(v ? v : builtin.c_str(), dirs);
+        return dirs;
+    };
+    std::vector<fs::path> sys_inc = system_dirs(
+        "PKG_CONFIG_SYSTEM_INCLUDE_PATH", res.system_includedirs);
+    std::vector<fs::path> sys_lib =
+        system_dirs("PKG_CONFIG_SYSTEM_LIBRARY_PATH", res.system_libdirs);
+    auto system_dir = [](const std::string &flag, const char *prefix,
+                         const std::vector<fs::path> &dirs) {
+        if (flag.compare(0, 2, prefix) != 0)
+            return false;
+        return std::find(dirs.begin(), dirs.end(), fs::path(flag.substr(2))) !=
+               dirs.end();
+    };
+    auto with_sysroot = [&](std::string flag) {
+        if (!sysroot.empty() && flag.size() > 2 && flag[2] == '/' &&
+            (flag.compare(0, 2, "-I") == 0 || flag.compare(0, 2, "-L") == 0))
+            flag.insert(2, sysroot);
+        return flag;
+    };
 
+    std::vector<std::string> &cflags = res.cflags;
+    cflags.clear();
+    for (const PcFile *pc : cflag_order) {
+        for (auto &f : split_pc_flags(pc_field(*pc, "cflags"))) {
+            if (!std::getenv("PKG_CONFIG_ALLOW_SYSTEM_CFLAGS") &&
+                system_dir(f, "-I", sys_inc))
+                continue;
+            f = with_sysroot(f);
+            if (std::find(cflags.begin(), cflags.end(), f) == cflags.end())
+                cflags.push_back(f);
+        }
+    }
+
+    // packages already come before what they require, so the flags keep
+    // that order, like pkg-config emits them: moving a -l could put it
+    // in front of a library it needs. a -Wl,--push-state ... --pop-state
+    // run is one unit, and since many packages repeat the same run only
+    // its last copy stays. otherwise only a repeat of the flag right
+    // before is merged. -L applies to every -l wherever it stands, the
+    // first one is enough.
+    std::vector<std::vector<std::string>> units;
+    int depth = 0;
+    for (const PcFile *pc : lib_order) {
+        for (const char *key : {"libs", "libs.private"}) {
+            if (!static_link && std::string(key) == "libs.private")
+                continue;
+            for (auto &f : split_pc_flags(pc_field(*pc, key))) {
+                if (!std::getenv("PKG_CONFIG_ALLOW_SYSTEM_LIBS") &&
+                    system_dir(f, "-L", sys_lib))
+                    continue;
+                if (depth == 0)
+                    units.emplace_back();
+                if (f.rfind("-Wl,--push-state", 0) == 0)
+                    depth++;
+                else if (f == "-Wl,--pop-state" && depth > 0)
+                    depth--;
+                units.back().push_back(with_sysroot(f));
+            }
+        }
+    }
+    std::vector<std::string> &libs = res.libs;
+    libs.clear();
+    for (size_t i = 0; i < units.size(); i++) {
+        const auto &u = units[i];
+        if (u.size() > 1) {
+            if (std::find(units.begin() + i + 1, units.end(), u) ==
+                units.end())
+                libs.insert(libs.end(), u.begin(), u.end());
+            continue;
+        }
+        if (!libs.empty() && libs.back() == u[0])
+            continue;
+        if (u[0].compare(0, 2, "-L") == 0 &&
+            std::find(libs.begin(), libs.end(), u[0]) != libs.end())
+            continue;
+        libs.push_back(u[0]);
+    }
+    return true;
+}
+
+void save_pkg_cache(const fs::path &cache_path, const PkgResolution &res) {
+    try {
+        std::error_code ec;
+        fs::create_directories(cache_path.parent_path(), ec);
+        std::ofstream out(cache_path, std::ios::trunc);
+        ENABLE_EXCEPTIONS(out);
+        out << "deps " << res.deps << "\n";
+        out << "env " << res.env << "\n";
+        out << "binary " << res.binary.string() << "\n";
+        out << "size " << res.size << "\n";
+        out << "mtime " << res.mtime << "\n";
+        out << "pc_path " << res.pc_path << "\n";
+        out << "system_includedirs " << res.system_includedirs << "\n";
+        out << "system_libdirs " << res.system_libdirs << "\n";
+        for (const auto &in : res.inputs)
+            out << "input " << in.size << " " << in.mtime << " "
+                << in.path.string() << "\n";
+        for (const auto &f : res.cflags)
+            out << "cflag " << f << "\n";
+        for (const auto &f : res.libs)
+            out << "lib " << f << "\n";
+    } catch (const std::exception &e) {
+        Logger::failLog("save_pkg_cache(): failed to write \"" +
+                            readable_path(cache_path) + "\"",
+                        e.what());
+    }
+}
+
+bool load_pkg_cache(const fs::path &cache_path, PkgResolution &res) {
+    std::ifstream in(cache_path);
+    if (!in)
+        return false;
+    res = PkgResolution{};
+    for (std::string line; std::getline(in, line);) {
+        auto sp = line.find(' ');
+        std::string key = line.substr(0, sp);
+        std::string val = sp == std::string::npos ? "" : line.substr(sp + 1);
+        if (key == "deps")
+            res.deps = val;
+        else if (key == "env")
+            res.env = val;
+        else if (key == "binary")
+            res.binary = val;
+        else if (key == "size")
+            res.size = std::strtoull(val.c_str(), nullptr, 10);
+        else if (key == "mtime")
+            res.mtime = std::strtoull(val.c_str(), nullptr, 10);
+        else if (key == "pc_path")
+            res.pc_path = val;
+        else if (key == "system_includedirs")
+            res.system_includedirs = val;
+        else if (key == "system_libdirs")
+            res.system_libdirs = val;
+        else if (key == "input") {
+            std::istringstream iss(val);
+            PkgResolution::Signed s;
+            iss >> s.size >> s.mtime;
+            std::string path;
+            std::getline(iss >> std::ws, path);
+            s.path = path;
+            res.inputs.push_back(s);
+        } else if (key == "cflag")
+            res.cflags.push_back(val);
+        else if (key == "lib")
+            res.libs.push_back(val);
+    }
+    return !res.deps.empty();
+}
+
+// the pkg-config binary, its built-in paths and the signatures of the
+// search directories; the .pc files are signed as they are read. the paths
+// are asked for only when `previous` was another binary.
+bool sign_pkg_resolution(const PkgResolution &previous, PkgResolution &res) {
+    res.binary = resolve_compiler_binary("pkg-config");
+    if (res.binary.empty() ||
+        !stat_signature(res.binary, res.size, res.mtime)) {
+        res.pc_path = DEFAULT_PC_PATH;
+        return false;
+    }
+    if (previous.binary == res.binary && previous.size == res.size &&
+        previous.mtime == res.mtime && !previous.pc_path.empty()) {
+        res.pc_path = previous.pc_path;
+        res.system_includedirs = previous.system_includedirs;
+        res.system_libdirs = previous.system_libdirs;
+    } else {
+        // one shell for the three; a pkg-config without the system dir
+        // variables prints empty lines and the defaults stay
+        std::string out;
+        try {
+            out = cmd_output("for v in pc_path pc_system_includedirs "
+                             "pc_system_libdirs; do pkg-config --variable $v "
+                             "pkg-config; done");
+        } catch (const std::exception &) {
+        }
+        std::istringstream iss(out);
+        std::string lines[3];
+        for (auto &line : lines)
+            std::getline(iss, line);
+        res.pc_path = lines[0].empty() ? DEFAULT_PC_PATH : lines[0];
+        if (!lines[1].empty())
+            res.system_includedirs = lines[1];
+        if (!lines[2].empty())
+            res.system_libdirs = lines[2];
+    }
+
+    res.inputs.clear();
+    for (auto &dir : pc_search_dirs(res.pc_path))
+        sign_input(dir, res);
+    return true;
+}
+
+bool pkg_resolution_valid(const PkgResolution &res, const std::string &deps) {
+    if (res.deps != deps || res.env != pkg_config_env())
+        return false;
+    uint64_t size = 0, mtime = 0;
+    if (!stat_signature(res.binary, size, mtime) || size != res.size ||
+        mtime != res.mtime)
+        return false;
+    for (const auto &in : res.inputs) {
+        size = mtime = 0;
+        stat_signature(in.path, size, mtime);
+        if (size != in.size || mtime != in.mtime)
+            return false;
+    }
+    return true;
+}
+
+void run_pkg_config(const std::vector<std::string> &names, bool static_link,
+                    PkgResolution &res) {
+    res.cflags.clear();
+    res.libs.clear();
+    // quoted, a constraint like "zlib >= 1.2" is one argument
+    std::string dep_list = static_link ? "--static " : "";
+    for (const auto &name : names) {
+        dep_list += "'";
+        for (char c : name)
+            dep_list += c == '\'' ? std::string("'\\''") : std::string(1, c);
+        dep_list += "' ";
+    }
     try {
         ///////// CFLAGS
         {
@@ -55,7 +645,7 @@ void resolve_pkg_config(Config &conf) {
             auto out = cmd_output(cmd);
             std::istringstream iss(out);
             for (std::string flag; iss >> flag;)
-                conf.compile_flags.push_back(flag);
+                res.cflags.push_back(flag);
         }
         ///////// LIBS
         {
@@ -63,7 +653,7 @@ void resolve_pkg_config(Config &conf) {
             auto out = cmd_output(cmd);
             std::istringstream iss(out);
             for (std::string flag; iss >> flag;)
-                conf.link_flags.push_back(flag);
+                res.libs.push_back(flag);
         }
     } catch (const std::exception &e) {
         Logger::failLog(std::string("failed to resolve dependencies [") +
@@ -71,4 +661,75 @@ void resolve_pkg_config(Config &conf) {
         throw "failed while resolving pkg-config";
     }
 }
+
+// adds the flags of conf.pkg_deps to `conf`. call once per loaded config,
+// the flags are appended. in order of preference: the in-memory result
+// (watch mode, daemon), the on-disk cache, running pkg-config.
+void resolve_pkg_config(Config &conf) {
+    if (conf.pkg_deps.empty())
+        return;
+
+    // --static takes part in the key, it changes the libs
+    std::string dep_list = conf.pkg_static ? "--static " : "";
+    std::vector<std::string> names;
+    for (auto &d : conf.pkg_deps) {
+        if (d.name.empty()) {
+            Logger::failLog("empty pkg-config dependency name",
+                            "failed at: resolve_pkg_config()");
+            throw "failed while resolving pkg-config";
+        }
+        dep_list += d.name + " ";
+        names.push_back(d.name);
+    }
+
+    auto apply = [&](const PkgResolution &res) {
+        conf.compile_flags.insert(conf.compile_flags.end(),
+                                  res.cflags.begin(), res.cflags.end());
+        conf.link_flags.insert(conf.link_flags.end(), res.libs.begin(),
+                               res.libs.end());
+    };
+
+    if (pkg_resolution.loaded &&
+        pkg_resolution_valid(pkg_resolution, dep_list)) {
+        apply(pkg_resolution);
+        return;
+    }
+
+    fs::path cache_path = fs::path(conf.root_dir) / "build/.pkgconfig";
+    PkgResolution cached;
+    if (load_pkg_cache(cache_path, cached) &&
+        pkg_resolution_valid(cached, dep_list)) {
+        pkg_resolution = std::move(cached);
+        pkg_resolution.loaded = true;
+        Logger::debug("pkg-config cache hit: " + dep_list);
+        apply(pkg_resolution);
+        return;
+    }
+
+    PkgResolution res;
+    res.deps = dep_list;
+    res.env = pkg_config_env();
+    // without a pkg-config binary to key on, the result is used but not
+    // cached
+    bool signed_ok = sign_pkg_resolution(
+        pkg_resolution.loaded ? pkg_resolution : cached, res);
+    size_t dir_inputs = res.inputs.size();
+    if (resolve_pc_native(names, conf.pkg_static, res)) {
+        Logger::debug("resolved .pc files: " + dep_list);
+    } else {
+        // a missing package or version: let pkg-config say what is wrong
+        res.inputs.resize(dir_inputs);
+        for (auto &pc : pc_closure(names, pc_search_dirs(res.pc_path)))
+            sign_input(pc, res);
+        run_pkg_config(names, conf.pkg_static, res);
+    }
+
+    Logger::infoLog("resolved pkg-config dependencies: " + dep_list);
+    apply(res);
+    if (!signed_ok)
+        return;
+    res.loaded = true;
+    pkg_resolution = std::move(res);
+    save_pkg_cache(cache_path, pkg_resolution);
+}
 #endif
@@ -0,0 +1,71 @@
+#ifndef PROCESS_H_
+#define PROCESS_H_
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <thread>
+
+// what run_command() returns when `interrupted` stopped the command. no
+// exit status or std::system() result is negative but -1, which is a
+// failure to start.
+#define COMMAND_CANCELLED -2
+
+// std::system() returns -1 when it can't fork (EAGAIN under load), which
+// is a failure like any other
+int system_status(const std::string &cmd) {
+    int rc = std::system(cmd.c_str());
+    return rc == -1 ? 127 : rc;
+}
+
+#ifdef __unix__
+#include <csignal>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char **environ;
+
+// runs `cmd` through /bin/sh, like std::system(). with `interrupted` set the
+// command gets its own process group and the callback is polled while it
+// runs; once it returns true the whole group (compiler driver, cc1plus, as,
+// ...) is killed and COMMAND_CANCELLED is returned.
+int run_command(const std::string &cmd,
+                const std::function<bool()> &interrupted = nullptr) {
+    if (!interrupted)
+        return system_status(cmd);
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attr, 0);
+    const char *argv[] = {"sh", "-c", cmd.c_str(), nullptr};
+    pid_t pid;
+    int rc = posix_spawn(&pid, "/bin/sh", nullptr, &attr,
+                         const_cast<char *const *>(argv), environ);
+    posix_spawnattr_destroy(&attr);
+    if (rc != 0)
+        return 127;
+
+    int status = 0;
+    while (true) {
+        pid_t r = waitpid(pid, &status, WNOHANG);
+        if (r == pid)
+            return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+        if (r == -1 && errno != EINTR)
+            return 1;
+        if (interrupted()) {
+            kill(-pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            return COMMAND_CANCELLED;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+#else
+int run_command(const std::string &cmd,
+                const std::function<bool()> & = nullptr) {
+    return system_status(cmd);
+}
+#endif
+#endif
@@ -1,11 +1,18 @@
 #ifndef SCAN_H_
 #define SCAN_H_
+#include "command.hh"
 #include "containers.hh"
+#include "exclude.hh"
 #include "exceptions.hh"
+#include "external_headers.hh"
+#include "git_index.hh"
 #include "helpers.hh"
 #include "logger.hh"
+#include "tokens.hh"
+#include "walk.hh"
 #include <algorithm>
 #include <filesystem>
+#include <sstream>
 
 namespace fs = std::filesystem;
 
@@ -60,6 +67,32 @@ uint64_t hash_file(const fs::path &p) {
     return hash;
 }
 
+// fingerprint used for headers: the raw bytes by default, or the token
+// stream (comments and formatting ignored) with token_header_hash on.
+uint64_t hash_header(const Config &conf, const fs::path &p) {
+    if (!conf.token_header_hash)
+        return conf.use_git_index ? git_blob_hash(p) : hash_file(p);
+
+    std::ifstream in(p, std::ios::binary);
+    if (!in) {
+        Logger::failLog("file does not exist: " + readable_path(p),
+                        " function: hash_header() failed.");
+        return 0;
+    }
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    std::string text = ss.str();
+    return hash_string(token_stream(text, needs_line_structure(text)));
+}
+
+SourceFile &add_source(const std::string &normalized) {
+    PathId id = path_pool.intern(normalized);
+    SourceFile &src = sources[id];
+    src = SourceFile{};
+    src.id = id;
+    return src;
+}
+
 void scan_explicit_sources(const Config &conf) {
     for (const auto &rel : conf.explicit_sources) {
         fs::path abs = fs::path(conf.root_dir) / rel;
@@ -72,9 +105,7 @@ void scan_explicit_sources(const Config &conf) {
         if (ext != ".c" && ext != ".cpp" && ext != ".cc")
             continue;
 
-        std::string normalized = normalize_path(abs);
-        sources[normalized] = {abs, fs::path("build/obj") /
-                                        abs.filename().replace_extension(".o")};
+        add_source(normalize_path(abs));
         Logger::infoLog("found explicit source: " + readable_path(abs));
     }
 }
@@ -86,6 +117,9 @@ void scan(const Config &conf) {
                         "function: scan()");
         throw std::runtime_error("scan()");
     }
+    // watch mode scans again after files were added or removed
+    sources.clear();
+    headers.clear();
 
     if (!conf.explicit_sources.empty()) {
         try {
@@ -101,30 +135,26 @@ void scan(const Config &conf) {
     }
 
     try {
-        for (auto &p : fs::recursive_directory_iterator(root)) {
-            if (!p.is_regular_file())
-                continue;
-            fs::path path = p.path();
+        compile_exclusions(conf);
+        if (dir_snapshot.empty())
+            load_dir_snapshot("build/.dirsnap");
+        std::vector<std::string> files = walk_tree(root, exclusions);
+        if (fs::is_directory("build"))
+            save_dir_snapshot("build/.dirsnap");
+
+        for (const std::string &file : files) {
+            fs::path path = file;
             std::string ext = path.extension().string();
             std::string normalized = normalize_path(path);
             std::string pretty_path = readable_path(path);
 
-            if (is_excluded(conf, path, ext))
-                continue;
-
             if (ext == ".c" || ext == ".cc" || ext == ".cpp") {
-                sources[normalized] = {
-                    p.path(), fs::path("build/obj") /
-                                  p.path().filename().replace_extension(".o")};
+                add_source(normalized);
                 Logger::infoLog("found source file: " + pretty_path);
             } else if (ext == ".h" || ext == ".hh" || ext == ".hpp") {
-                HeaderFile hf;
-                hf.path = p.path();
-                hf.hash = hash_file(p.path());
-                headers[normalized] = hf;
+                // hashed later, and only if some source includes it
+                headers[path_pool.intern(normalized)] = HeaderFile{};
                 Logger::infoLog("found header file: " + pretty_path);
-                Logger::debug("hashed header on scan: " + pretty_path +
-                              " with hash: " + std::to_string(hf.hash));
             }
         }
 
@@ -142,15 +172,22 @@ void scan(const Config &conf) {
     }
 }
 
+// with external header tracking the depfile has to list system headers as
+// well (-M instead of -MM). it gets its own extension so that toggling the
+// option regenerates it instead of reusing one of the wrong kind.
+fs::path depfile_path(const SourceFile &src, bool system_headers) {
+    return object_path(src).replace_extension(system_headers ? ".sd" : ".d");
+}
+
 void generate_deps(const std::string &log_path, const Config &conf,
                    const SourceFile &src) {
-    fs::path dep_file = src.object;
-    dep_file.replace_extension(".d");
+    fs::path dep_file = depfile_path(src, conf.track_external_headers);
 
     std::string cmd = conf.compiler;
-    cmd += " -MM -MF " + dep_file.string();
-    cmd += " -MT " + src.object.string();
-    cmd += " " + src.path.string();
+    cmd += conf.track_external_headers ? " -M" : " -MM";
+    cmd += " -MF " + dep_file.string();
+    cmd += " -MT " + object_path(src).string();
+    cmd += " " + source_path(src);
 
     for (const auto &inc : conf.include_dirs) {
         cmd += " -I" + inc.string();
@@ -168,12 +205,6 @@ void generate_deps(const std::string &log_path, const Config &conf,
     }
 }
 
-fs::path depfile_path(const fs::path &src) {
-    fs::path p = src;
-    p.replace_extension(".d");
-    return fs::path("build/obj") / p.filename();
-}
-
 bool need_regen_deps(const fs::path &src, const fs::path &depfile) {
     if (!fs::exists(depfile)) {
         return true;
@@ -214,71 +245,156 @@ std::vector<fs::path> parse_dep_file(const fs::path &dep_path) {
     return deps;
 }
 
-void load_compiler_deps(SourceFile &src) {
-    fs::path dep = src.object;
-    dep.replace_extension(".d");
+void load_compiler_deps(const Config &conf, SourceFile &src) {
+    fs::path dep = depfile_path(src, conf.track_external_headers);
 
     auto deps = parse_dep_file(dep);
 
-    src.includes.clear();
+    // depfile entries are normalized like the source's key
+    src.inc_begin = static_cast<uint32_t>(include_edges.size());
     for (const auto &d : deps) {
-        if (d != src.path) {
-            src.includes.push_back(d);
+        PathId inc = path_pool.intern(d.string());
+        if (inc != src.id) {
+            include_edges.push_back(inc);
+        }
+    }
+    src.inc_end = static_cast<uint32_t>(include_edges.size());
+}
+
+// true if `src` was last compiled with a different command (flags, defines,
+// include dirs, compiler), or was never compiled with a recorded one.
+bool command_changed(const SourceFile &src) {
+    const uint64_t *old = old_cmd_hashes.find(src.id);
+    return !old || *old != src.cmd_hash;
+}
+
+// hashes a header at most once per content change: the hash is memoized by
+// path and stat signature, which also carries it across watch-mode builds.
+void ensure_hashed(const Config &conf, PathId id, HeaderFile &hf) {
+    if (hf.hashed)
+        return;
+    // the blob id is a raw content hash, token hashing needs the text
+    std::string path = path_pool.str(id);
+    if (conf.use_git_index && !conf.token_header_hash &&
+        git_fingerprint(path, id, hf.hash)) {
+        hf.hashed = true;
+        return;
+    }
+    uint64_t size = 0, mtime = 0;
+    bool have_stat = stat_signature(path, size, mtime);
+    const HashMemo *memo = header_memo.find(id);
+    if (have_stat && memo && memo->size == size && memo->mtime == mtime &&
+        memo->tokens == conf.token_header_hash &&
+        memo->git_blob == conf.use_git_index) {
+        hf.hash = memo->hash;
+    } else {
+        hf.hash = hash_header(conf, path);
+        if (have_stat)
+            header_memo[id] = {size, mtime, hf.hash, conf.token_header_hash,
+                               conf.use_git_index};
+        Logger::debug("hashed header: " + relative_path(id));
+    }
+    hf.hashed = true;
+}
+
+void hash_includes(const Config &conf, const SourceFile &src) {
+    for (PathId inc : includes_of(src)) {
+        HeaderFile *hf = headers.find(inc);
+        if (!hf) {
+            if (!conf.track_external_headers)
+                continue;
+            // covered by its group's fingerprint
+            if (external_group(inc) != NO_PATH)
+                continue;
+            hf = &headers[inc];
         }
+        ensure_hashed(conf, inc, *hf);
     }
 }
 
+// hashes every header reachable from a source, and nothing else. this has
+// to cover sources that are already known to be modified as well, since
+// their headers' hashes are saved with the cache after the build.
+void hash_reachable_headers(const Config &conf) {
+    // the maps outlive a build in watch mode, the memo keeps this cheap
+    for (auto &[_, hf] : headers)
+        hf.hashed = false;
+    if (conf.track_external_headers)
+        load_external_roots(conf);
+    for (auto &[_, src] : sources)
+        hash_includes(conf, src);
+}
+
+void hash_source(const Config &conf, SourceFile &src) {
+    std::string path = path_pool.str(src.id);
+    if (!conf.use_git_index)
+        src.hash = hash_file(path);
+    else if (!git_fingerprint(path, src.id, src.hash))
+        src.hash = git_blob_hash(path);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////
 void mark_modified(const Config &conf) {
-    for (auto &[_, src] : sources) {
-        src.hash = hash_file(src.path);
-
-        bool hash_changed = old_hashes[normalize_path(src.path)] != src.hash;
+    if (conf.use_git_index)
+        load_git_index(conf);
+    hash_reachable_headers(conf);
+    for (auto &[id, src] : sources) {
+        hash_source(conf, src);
+
+        const uint64_t *old_hash = old_hashes.find(id);
+        bool hash_changed = !old_hash || *old_hash != src.hash;
         if (hash_changed)
-            Logger::warningLog("file modified: " + readable_path(src.path));
-        if (!old_hashes.count(normalize_path(
-                src.path)) // < if source file doesn't exist in our set of
-                           // hashed files (it wasn't there last time we built)
+            Logger::warningLog("file modified: " + source_path(src));
+        // unity members compile into a chunk and have no object of their
+        // own. the chunk's object is checked when the chunk is built.
+        bool object_missing = !conf.unity_b && !fs::exists(object_path(src));
+        if (!old_hash // < if source file doesn't exist in our set of
+                      // hashed files (it wasn't there last time we built)
             || hash_changed // <  or it does exist, but the hash doesn't match
                             // the new one (the contents changed)
-            || !fs::exists(src.object)) { // < or it exists, and its hash
-                                          // exists, but its object file doesn't
+            || object_missing) { // < or it exists, and its hash exists, but
+                                 // its object file doesn't
             src.modified = true; // < then mark it as modified
             continue;
         }
 
+        if (command_changed(src)) {
+            Logger::warningLog("compile command changed: " +
+                               source_path(src));
+            src.modified = true;
+            continue;
+        }
+
         // at this point we know the source didn't change in any way, we check
         // if the headers did
-        for (const fs::path &inc : src.includes) {
-            fs::path resolved_include = src.path.parent_path() / inc;
-            std::string normalized = normalize_path(resolved_include);
-            std::string pretty_path = readable_path(resolved_include);
-
-            auto it = headers.find(normalized);
-
-            if (it == headers.end()) {
-                if (!conf.track_external_headers) {
-                    // Logger::debug("  skipping external header: " +
-                    // pretty_path);
+        for (PathId inc : includes_of(src)) {
+            const HeaderFile *hf = headers.find(inc);
+            if (!hf) {
+                // external header, tracked through its group if at all
+                if (!conf.track_external_headers)
+                    continue;
+                PathId group = external_group(inc);
+                if (group == NO_PATH)
                     continue;
+                const uint64_t *oh = old_hashes.find(group);
+                if (!oh || *oh != external_hashes[group]) {
+                    src.modified = true;
+                    Logger::warningLog(
+                        "external headers changed: " +
+                        std::string(path_pool.view(group).substr(1)));
+                    break;
                 }
-                // Logger::debug("  tracking new external header: " +
-                // pretty_path);
-                HeaderFile hf;
-                hf.path = resolved_include;
-                hf.hash = hash_file(resolved_include);
-                it = headers.emplace(normalized, std::move(hf)).first;
+                continue;
             }
+            if (!hf->hashed)
+                continue;
 
-            auto oh = old_hashes.find(normalized);
-            if (oh ==
-                    old_hashes.end() // if the hash isn't in the old hashes or..
-                ||
-                oh->second != it->second.hash) { // if it is in the old hashes
-                                                 // but it has been modified.
+            const uint64_t *oh = old_hashes.find(inc);
+            if (!oh // if the hash isn't in the old hashes or..
+                || *oh != hf->hash) { // if it is in the old hashes
+                                      // but it has been modified.
                 src.modified = true;
-                Logger::warningLog("file modified: " +
-                                   readable_path(it->second.path));
+                Logger::warningLog("file modified: " + relative_path(inc));
                 break;
             }
         }
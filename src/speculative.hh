@@ -0,0 +1,129 @@
+#ifndef SPECULATIVE_H_
+#define SPECULATIVE_H_
+#include "command.hh"
+#include "config.hh"
+#include "containers.hh"
+#include "diagnostics.hh"
+#include "file_watch.hh"
+#include "logger.hh"
+#include "process.hh"
+#include "scan.hh"
+#include <atomic>
+#include <future>
+#include <memory>
+
+// --speculative (watch mode): a source saved with IN_CLOSE_WRITE starts
+// compiling right away, at a lower priority and into a side object, while
+// the watcher is still debouncing. when the build gets to that source it
+// adopts the result if the inputs the speculative compile saw are still the
+// inputs of the build, and throws it away otherwise.
+
+struct Speculation {
+    fs::path object;
+    std::string logfile;
+    // input_fingerprint() of what the compile read
+    uint64_t fingerprint = 0;
+    std::shared_ptr<std::atomic<bool>> cancel;
+    std::future<int> result;
+};
+
+FlatMap<Speculation> speculations;
+
+void discard_speculation(Speculation &spec) {
+    spec.cancel->store(true);
+    if (spec.result.valid())
+        spec.result.wait();
+    std::error_code ec;
+    fs::remove(spec.object, ec);
+}
+
+void discard_speculations() {
+    for (auto &[_, spec] : speculations)
+        discard_speculation(spec);
+    speculations.clear();
+}
+
+// the fingerprint of `src` as its files are on disk right now. the header
+// memo makes this a stat per unchanged header.
+uint64_t current_fingerprint(const Config &conf, const SourceFile &src) {
+    SourceFile now = src;
+    hash_source(conf, now);
+    return input_fingerprint(src, now.hash,
+                             [&](PathId id, const HeaderFile &hf) {
+                                 HeaderFile copy = hf;
+                                 copy.hashed = false;
+                                 ensure_hashed(conf, id, copy);
+                                 return copy.hash;
+                             });
+}
+
+// starts a speculative compile for every source that was just written
+void speculate(const Config &conf, const std::vector<WatchEvent> &events) {
+    if (conf.unity_b)
+        return;
+    for (const auto &ev : events) {
+        if (!closed_after_write(ev))
+            continue;
+        PathId id = path_pool.find(normalize_path(ev.path));
+        SourceFile *src = id == NO_PATH ? nullptr : sources.find(id);
+        if (!src)
+            continue;
+
+        if (Speculation *old = speculations.find(id)) {
+            discard_speculation(*old);
+            speculations.erase(id);
+        }
+
+        fs::path object = object_path(*src);
+        std::string stem = object.stem().string();
+        Speculation &spec = speculations[id];
+        spec.object = object.parent_path() / (stem + ".spec.o");
+        spec.logfile = "build/logs/log_" + stem + ".spec.out";
+        spec.fingerprint = current_fingerprint(conf, *src);
+        spec.cancel = std::make_shared<std::atomic<bool>>(false);
+
+        std::string cmd = "nice -n 10 " +
+                          compile_command(conf, *src, spec.object) + " > " +
+                          spec.logfile + " 2>&1";
+        auto cancel = spec.cancel;
+        spec.result = std::async(std::launch::async, [cmd, cancel] {
+            return run_command(cmd, [cancel] { return cancel->load(); });
+        });
+        Logger::debug("speculative compile: " + source_path(*src));
+    }
+}
+
+bool has_speculation(const SourceFile &src) {
+    return speculations.count(src.id);
+}
+
+// takes over the speculative object for `src` if its inputs are unchanged,
+// waiting for the compile to finish. a failed speculative compile is not
+// adopted, the regular compile reports the errors.
+bool adopt_speculation(SourceFile &src) {
+    Speculation *spec = speculations.find(src.id);
+    if (!spec)
+        return false;
+    bool adopted = false;
+    if (spec->result.get() == 0 &&
+        spec->fingerprint == input_fingerprint(src)) {
+        fs::path object = object_path(src);
+        std::error_code ec;
+        fs::rename(spec->object, object, ec);
+        if (!ec) {
+            clear_failure(object);
+            std::string diags = store_diagnostics(object, spec->logfile);
+            src.obj_hash = hash_file(object);
+            src.modified = false;
+            Logger::successLog("compiled: " + source_path(src) +
+                               " (speculative)");
+            Logger::printDiagnostics(diags);
+            adopted = true;
+        }
+    }
+    std::error_code ec;
+    fs::remove(spec->object, ec);
+    speculations.erase(src.id);
+    return adopted;
+}
+#endif
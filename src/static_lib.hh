@@ -1,7 +1,9 @@
 #ifndef STATICLIB_H_
 #define STATICLIB_H_
 #include "config.hh"
+#include "diagnostics.hh"
 #include "scan.hh"
+#include "toolchain.hh"
 #include "tests.hh"
 
 fs::path lib_cache_path(const StaticLib &lib) {
@@ -22,6 +24,7 @@ uint64_t hash_lib(const Config &conf, const StaticLib &lib) {
 
     for (unsigned char c : conf.compiler)
         mix(c);
+    mix(toolchain.identity);
     for (const auto &f : flags)
         for (unsigned char c : f)
             mix(c);
@@ -65,6 +68,10 @@ bool build_static_lib(const Config &conf, const StaticLib &lib) {
     try {
         if (!conf.rebuild_all && lib_unmodified(conf, lib)) {
             Logger::debug("static lib up-to-date: " + lib.name.string());
+            for (const auto &src : lib.sources)
+                replay_diagnostics(src,
+                                   fs::path("build/lib") / lib.name /
+                                       src.filename().replace_extension(".o"));
             return true;
         }
         std::vector<fs::path> objects;
@@ -86,10 +93,12 @@ bool build_static_lib(const Config &conf, const StaticLib &lib) {
             std::string cmd_no_log = cmd;
             std::string logfile =
                 "build/logs/log_" + src.filename().stem().string() + ".out";
-            cmd += " >> " + logfile + " 2>&1";
+            cmd += " > " + logfile + " 2>&1";
             if (std::system(cmd.c_str()) != 0)
                 return false;
+            std::string diags = store_diagnostics(obj, logfile);
             Logger::successLog("compiled: " + readable_path(src));
+            Logger::printDiagnostics(diags);
             Logger::infoLog("compile command was: " + cmd_no_log);
         }
         fs::remove(lib_dir + lib.archive.string());
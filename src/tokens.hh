@@ -0,0 +1,127 @@
+#ifndef TOKENS_H_
+#define TOKENS_H_
+#include <cctype>
+#include <string>
+
+// strips a C/C++ source down to the parts the compiler actually sees:
+// comments are dropped, runs of blanks become one space, and string, char
+// and raw string literals are kept verbatim. two headers with the same
+// stream compile the same, so their dependents don't need a rebuild.
+//
+// empty and comment-only lines are collapsed too, unless `keep_lines` is
+// set: then every newline, including the ones inside comments, is kept so
+// that __LINE__ (and everything built on it, like assert()) expands the same
+// as before.
+std::string token_stream(const std::string &text, bool keep_lines) {
+    std::string out;
+    out.reserve(text.size());
+    bool pending_space = false;
+    size_t i = 0;
+    const size_t n = text.size();
+
+    auto is_ident = [](char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+    };
+    auto newline = [&]() {
+        pending_space = false;
+        if (keep_lines || (!out.empty() && out.back() != '\n'))
+            out += '\n';
+    };
+    auto emit = [&](char c) {
+        if (pending_space && !out.empty() && out.back() != '\n')
+            out += ' ';
+        pending_space = false;
+        out += c;
+    };
+
+    while (i < n) {
+        char c = text[i];
+
+        if (c == '\n') {
+            newline();
+            i++;
+        } else if (c == ' ' || c == '\t' || c == '\r' || c == '\f' ||
+                   c == '\v') {
+            pending_space = true;
+            i++;
+        } else if (c == '\\' && i + 1 < n && text[i + 1] == '\n') {
+            // line splice: part of the same logical line
+            emit('\\');
+            out += '\n';
+            i += 2;
+        } else if (c == '/' && i + 1 < n && text[i + 1] == '/') {
+            while (i < n && text[i] != '\n') {
+                if (text[i] == '\\' && i + 1 < n && text[i + 1] == '\n') {
+                    if (keep_lines)
+                        out += '\n';
+                    i++;
+                }
+                i++;
+            }
+            pending_space = true;
+        } else if (c == '/' && i + 1 < n && text[i + 1] == '*') {
+            i += 2;
+            while (i < n &&
+                   !(text[i] == '*' && i + 1 < n && text[i + 1] == '/')) {
+                if (text[i] == '\n' && keep_lines)
+                    out += '\n';
+                i++;
+            }
+            i = i + 2 < n ? i + 2 : n;
+            pending_space = true;
+        } else if (c == 'R' && i + 1 < n && text[i + 1] == '"' &&
+                   (i == 0 || !is_ident(text[i - 1]) || text[i - 1] == '8' ||
+                    text[i - 1] == 'L' || text[i - 1] == 'u' ||
+                    text[i - 1] == 'U')) {
+            // raw string literal: R"delim( ... )delim"
+            size_t open = text.find('(', i + 2);
+            if (open == std::string::npos) {
+                emit(c);
+                i++;
+                continue;
+            }
+            std::string close =
+                ")" + text.substr(i + 2, open - (i + 2)) + "\"";
+            size_t end = text.find(close, open + 1);
+            end = end == std::string::npos ? n : end + close.size();
+            emit('R');
+            out.append(text, i + 1, end - (i + 1));
+            i = end;
+        } else if (c == '"' ||
+                   (c == '\'' &&
+                    (out.empty() ||
+                     !std::isxdigit(static_cast<unsigned char>(out.back()))))) {
+            // string or char literal; a quote right after a hex digit is a
+            // digit separator (1'000) and handled as a plain character.
+            emit(c);
+            i++;
+            while (i < n && text[i] != c && text[i] != '\n') {
+                if (text[i] == '\\' && i + 1 < n) {
+                    out += text[i];
+                    i++;
+                }
+                out += text[i];
+                i++;
+            }
+            if (i < n && text[i] == c) {
+                out += c;
+                i++;
+            }
+        } else {
+            emit(c);
+            i++;
+        }
+    }
+    return out;
+}
+
+// __LINE__ is the only way a header's line layout leaks into the code. be
+// conservative and keep the layout whenever anything line-based shows up.
+bool needs_line_structure(const std::string &text) {
+    return text.find("__LINE__") != std::string::npos ||
+           text.find("assert") != std::string::npos ||
+           text.find("source_location") != std::string::npos ||
+           text.find("__builtin_LINE") != std::string::npos;
+}
+
+#endif
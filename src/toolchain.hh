@@ -0,0 +1,223 @@
+#ifndef TOOLCHAIN_H_
+#define TOOLCHAIN_H_
+#include "config.hh"
+#include "exceptions.hh"
+#include "helpers.hh"
+#include "logger.hh"
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// identity of the compiler behind Config::compiler. probing it means
+// spawning the compiler, so the result is cached in "build/.toolchain" and
+// keyed by the resolved binary's path, size and mtime: a normal build only
+// pays a single stat() to confirm the cached probe is still valid.
+struct Toolchain {
+    std::string compiler;
+    std::string path_env;
+    fs::path binary;
+    uint64_t size = 0;
+    uint64_t mtime = 0;
+    // hash of everything below, mixed into every object's cache key
+    uint64_t identity = 0;
+    std::string version;
+    std::string target;
+    // the compiler's default #include <...> search list, canonical
+    std::vector<fs::path> include_dirs;
+    bool loaded = false;
+};
+
+Toolchain toolchain;
+
+// compiler launchers: they run the next word of the command, so that word
+// is the compiler whose identity matters
+bool is_compiler_launcher(const fs::path &exe) {
+    std::string name = exe.filename().string();
+    return name == "ccache" || name == "sccache" || name == "distcc";
+}
+
+// the binary that actually compiles: "ccache g++" resolves g++, and a
+// masquerading /usr/lib/ccache/g++ -> ccache link is skipped for the next
+// g++ in PATH, the one ccache itself would run.
+fs::path resolve_compiler_binary(const std::string &compiler) {
+    std::istringstream words(compiler);
+    std::string exe;
+    while (words >> exe && is_compiler_launcher(exe))
+        exe.clear();
+    if (exe.empty())
+        return {};
+    if (exe.find('/') != std::string::npos)
+        return normalize_fs_path(exe);
+
+    const char *path_env = std::getenv("PATH");
+    std::istringstream dirs(path_env ? path_env : "");
+    for (std::string dir; std::getline(dirs, dir, ':');) {
+        if (dir.empty())
+            continue;
+        fs::path candidate = fs::path(dir) / exe;
+        if (access(candidate.c_str(), X_OK) != 0)
+            continue;
+        std::error_code ec;
+        fs::path target = fs::canonical(candidate, ec);
+        if (!ec && is_compiler_launcher(target))
+            continue;
+        return normalize_fs_path(candidate);
+    }
+    return {};
+}
+
+// runs the compiler once in verbose preprocessor mode and pulls the version,
+// target triple and default include search list out of its output.
+bool probe_toolchain(Toolchain &tc) {
+    std::string out;
+    try {
+        out = cmd_output(tc.compiler + " -E -x c++ - -v < /dev/null 2>&1");
+    } catch (const std::exception &e) {
+        Logger::failLog("failed to probe compiler \"" + tc.compiler + "\"",
+                        e.what());
+        return false;
+    }
+
+    std::istringstream iss(out);
+    bool in_search_list = false;
+    tc.include_dirs.clear();
+    for (std::string line; std::getline(iss, line);) {
+        if (line.rfind("#include <...> search starts here:", 0) == 0) {
+            in_search_list = true;
+        } else if (line.rfind("End of search list.", 0) == 0) {
+            in_search_list = false;
+        } else if (in_search_list && !line.empty() && line[0] == ' ') {
+            std::string dir = line.substr(1);
+            // clang marks framework directories with a suffix
+            auto fw = dir.find(" (framework directory)");
+            if (fw != std::string::npos)
+                dir.erase(fw);
+            tc.include_dirs.push_back(normalize_fs_path(dir));
+        } else if (line.rfind("Target: ", 0) == 0) {
+            tc.target = line.substr(8);
+        } else if (tc.version.empty() &&
+                   line.find(" version ") != std::string::npos) {
+            tc.version = line;
+        }
+    }
+
+    // '\n' separates the fields so they can't run into each other
+    uint64_t h = hash_string(tc.binary.string() + "\n");
+    h = hash_string(tc.version + "\n", h);
+    h = hash_string(tc.target + "\n", h);
+    for (const auto &dir : tc.include_dirs)
+        h = hash_string(dir.string() + "\n", h);
+    tc.identity = h;
+    return true;
+}
+
+void save_toolchain(const fs::path &cache_path, const Toolchain &tc) {
+    try {
+        std::ofstream out(cache_path, std::ios::trunc);
+        ENABLE_EXCEPTIONS(out);
+        out << "compiler " << tc.compiler << "\n";
+        out << "path_env " << tc.path_env << "\n";
+        out << "binary " << tc.binary.string() << "\n";
+        out << "size " << tc.size << "\n";
+        out << "mtime " << tc.mtime << "\n";
+        out << "identity " << tc.identity << "\n";
+        out << "version " << tc.version << "\n";
+        out << "target " << tc.target << "\n";
+        for (const auto &dir : tc.include_dirs)
+            out << "include " << dir.string() << "\n";
+    } catch (const std::exception &e) {
+        Logger::failLog("save_toolchain(): failed to write \"" +
+                            readable_path(cache_path) + "\"",
+                        e.what());
+    }
+}
+
+bool load_toolchain_cache(const fs::path &cache_path, Toolchain &tc) {
+    std::ifstream in(cache_path);
+    if (!in)
+        return false;
+    tc = Toolchain{};
+    for (std::string line; std::getline(in, line);) {
+        auto sp = line.find(' ');
+        std::string key = line.substr(0, sp);
+        std::string val = sp == std::string::npos ? "" : line.substr(sp + 1);
+        if (key == "compiler")
+            tc.compiler = val;
+        else if (key == "path_env")
+            tc.path_env = val;
+        else if (key == "binary")
+            tc.binary = val;
+        else if (key == "size")
+            tc.size = std::strtoull(val.c_str(), nullptr, 10);
+        else if (key == "mtime")
+            tc.mtime = std::strtoull(val.c_str(), nullptr, 10);
+        else if (key == "identity")
+            tc.identity = std::strtoull(val.c_str(), nullptr, 10);
+        else if (key == "version")
+            tc.version = val;
+        else if (key == "target")
+            tc.target = val;
+        else if (key == "include")
+            tc.include_dirs.emplace_back(val);
+    }
+    return tc.identity != 0;
+}
+
+// makes `toolchain` describe conf.compiler. in order of preference: the
+// in-memory result (watch mode), the on-disk cache, a fresh probe.
+void load_toolchain(const Config &conf) {
+    fs::path cache_path = fs::path(conf.root_dir) / "build/.toolchain";
+    const char *path_env_c = std::getenv("PATH");
+    std::string path_env = path_env_c ? path_env_c : "";
+    // resolved every time: a cache from before launchers were skipped, or
+    // a compiler that appeared earlier in PATH, must not match
+    fs::path binary = resolve_compiler_binary(conf.compiler);
+
+    auto still_valid = [&](const Toolchain &tc) {
+        if (tc.compiler != conf.compiler || tc.path_env != path_env ||
+            tc.binary != binary)
+            return false;
+        uint64_t size, mtime;
+        return stat_signature(tc.binary, size, mtime) && size == tc.size &&
+               mtime == tc.mtime;
+    };
+
+    if (toolchain.loaded && still_valid(toolchain))
+        return;
+
+    Toolchain cached;
+    if (load_toolchain_cache(cache_path, cached) && still_valid(cached)) {
+        toolchain = std::move(cached);
+        toolchain.loaded = true;
+        Logger::debug("toolchain cache hit: " + toolchain.version);
+        return;
+    }
+
+    Toolchain tc;
+    tc.compiler = conf.compiler;
+    tc.path_env = path_env;
+    tc.binary = binary;
+    if (tc.binary.empty() || !stat_signature(tc.binary, tc.size, tc.mtime) ||
+        !probe_toolchain(tc)) {
+        // unknown compiler: fall back to its name so keys stay usable, the
+        // compile itself will report the real problem.
+        Logger::debug("could not identify compiler: " + conf.compiler);
+        toolchain = Toolchain{};
+        toolchain.compiler = conf.compiler;
+        toolchain.identity = hash_string(conf.compiler);
+        return;
+    }
+
+    Logger::infoLog("probed compiler: " + tc.version);
+    tc.loaded = true;
+    toolchain = std::move(tc);
+    save_toolchain(cache_path, toolchain);
+}
+
+#endif
@@ -0,0 +1,358 @@
+#ifndef WALK_H_
+#define WALK_H_
+#include "exceptions.hh"
+#include "exclude.hh"
+#include "logger.hh"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// returns every regular file under `root` that `excl` lets through, sorted,
+// so the result does not depend on the order in which the directories
+// happened to be visited. excluded directories are pruned without being
+// listed. paths are built as root + "/" + name, matching what
+// fs::recursive_directory_iterator yields. symlinked directories are not
+// followed.
+std::vector<std::string> walk_tree(const fs::path &root,
+                                   const ExclusionMatcher &excl);
+
+std::string join_path(const std::string &dir, const char *name) {
+    return dir.back() == '/' ? dir + name : dir + "/" + name;
+}
+
+// "./src/foo.cc" -> "src/foo.cc", for a walk rooted at "."
+std::string walk_relative(const std::string &path, size_t root_len) {
+    return path.size() > root_len ? path.substr(root_len) : "";
+}
+
+// a directory as of the last walk: its mtime and its entries, 'f' for
+// regular files (symlinks resolved) and 'd' for directories. adding,
+// removing or renaming an entry bumps the directory's mtime, so a listing
+// whose mtime still matches can be reused without reading the directory.
+struct DirListing {
+    uint64_t mtime = 0;
+    std::vector<std::pair<std::string, char>> entries;
+};
+
+// listings of the last walk, keyed by directory path as walked. persisted
+// in "build/.dirsnap" and kept in memory across watch-mode builds.
+std::unordered_map<std::string, DirListing> dir_snapshot;
+// wall-clock time (ns) the snapshot was taken at
+uint64_t dir_snapshot_time = 0;
+bool dir_snapshot_dirty = false;
+
+// a directory changed this close to the snapshot may have changed again
+// within the same mtime tick, so its listing isn't trusted.
+#define DIRSNAP_RACY_NS 2000000000ULL
+
+uint64_t now_ns() {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count());
+}
+
+void load_dir_snapshot(const fs::path &snap_path) {
+    std::ifstream in(snap_path);
+    if (!in)
+        return;
+    std::string line;
+    if (!std::getline(in, line) || line.rfind("mkc-dirsnap 1 ", 0) != 0)
+        return;
+    dir_snapshot.clear();
+    dir_snapshot_time = std::strtoull(line.c_str() + 14, nullptr, 10);
+
+    // "D <mtime> <dir>" starts a directory, "f <name>"/"d <name>" follow
+    DirListing *cur = nullptr;
+    while (std::getline(in, line)) {
+        if (line.size() < 3 || line[1] != ' ')
+            continue;
+        if (line[0] == 'D') {
+            auto sp = line.find(' ', 2);
+            if (sp == std::string::npos)
+                continue;
+            cur = &dir_snapshot[line.substr(sp + 1)];
+            cur->mtime = std::strtoull(line.c_str() + 2, nullptr, 10);
+        } else if (cur && (line[0] == 'f' || line[0] == 'd')) {
+            cur->entries.emplace_back(line.substr(2), line[0]);
+        }
+    }
+}
+
+void save_dir_snapshot(const fs::path &snap_path) {
+    if (!dir_snapshot_dirty)
+        return;
+    fs::path tmp = snap_path;
+    tmp += ".tmp";
+    try {
+        std::ofstream out(tmp, std::ios::trunc);
+        ENABLE_EXCEPTIONS(out);
+        out << "mkc-dirsnap 1 " << dir_snapshot_time << "\n";
+        for (const auto &[dir, listing] : dir_snapshot) {
+            out << "D " << listing.mtime << " " << dir << "\n";
+            for (const auto &[name, type] : listing.entries)
+                out << type << " " << name << "\n";
+        }
+        out.close();
+        fs::rename(tmp, snap_path);
+        dir_snapshot_dirty = false;
+    } catch (const std::exception &e) {
+        Logger::failLog("save_dir_snapshot(): failed to write \"" +
+                            snap_path.string() + "\"",
+                        e.what());
+    }
+}
+
+#ifdef __linux__
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <dirent.h>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+
+// layout of the records returned by getdents64(2)
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// one per walker thread. a thread pops directories from the back of its own
+// queue and steals from the front of the others' when it runs dry.
+struct WalkWorker {
+    std::mutex lock;
+    std::deque<std::string> dirs;
+    std::vector<std::string> files;
+    std::vector<std::pair<std::string, DirListing>> listings;
+    size_t reused = 0;
+};
+
+void walk_error(const std::string &dir) {
+    static std::mutex log_mutex;
+    std::lock_guard<std::mutex> l(log_mutex);
+    Logger::failLog("error opening directory \"" + dir +
+                    "\", please check for permission denial.");
+}
+
+// lists one directory with getdents64. d_type tells files from directories
+// without a stat() per entry; only symlinks and filesystems that don't fill
+// d_type need one.
+bool read_dir(const std::string &dir, DirListing &listing) {
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    alignas(linux_dirent64) char buf[32768];
+    while (true) {
+        long n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+        if (n <= 0)
+            break;
+        for (long off = 0; off < n;) {
+            auto *d = reinterpret_cast<linux_dirent64 *>(buf + off);
+            off += d->d_reclen;
+            const char *name = d->d_name;
+            if (name[0] == '.' &&
+                (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+
+            unsigned char type = d->d_type;
+            if (type == DT_UNKNOWN || type == DT_LNK) {
+                struct stat st;
+                int flags = type == DT_UNKNOWN ? AT_SYMLINK_NOFOLLOW : 0;
+                if (fstatat(fd, name, &st, flags) != 0)
+                    continue;
+                if (S_ISREG(st.st_mode))
+                    type = DT_REG;
+                else if (S_ISDIR(st.st_mode) && type == DT_UNKNOWN)
+                    type = DT_DIR;
+                else
+                    continue;
+            }
+
+            // the snapshot is line based
+            if (std::strchr(name, '\n'))
+                continue;
+            if (type == DT_DIR)
+                listing.entries.emplace_back(name, 'd');
+            else if (type == DT_REG)
+                listing.entries.emplace_back(name, 'f');
+        }
+    }
+    close(fd);
+    return true;
+}
+
+// one stat() to get the directory's mtime; the listing is only read if the
+// snapshot doesn't hold a trustworthy one for that mtime.
+void walk_dir(const std::string &dir, size_t root_len,
+              const ExclusionMatcher &excl, WalkWorker &me,
+              std::vector<std::string> &subdirs) {
+    uint64_t size = 0, mtime = 0;
+    if (!stat_signature(dir, size, mtime)) {
+        walk_error(dir);
+        return;
+    }
+
+    auto old = dir_snapshot.find(dir);
+    if (old != dir_snapshot.end() && old->second.mtime == mtime &&
+        mtime + DIRSNAP_RACY_NS < dir_snapshot_time) {
+        me.listings.emplace_back(dir, old->second);
+        me.reused++;
+    } else {
+        DirListing fresh;
+        fresh.mtime = mtime;
+        if (!read_dir(dir, fresh)) {
+            walk_error(dir);
+            return;
+        }
+        me.listings.emplace_back(dir, std::move(fresh));
+    }
+
+    for (const auto &[name, type] : me.listings.back().second.entries) {
+        std::string path = join_path(dir, name.c_str());
+        std::string rel = walk_relative(path, root_len);
+        if (type == 'd') {
+            if (!excl.excluded_dir(rel, name))
+                subdirs.push_back(std::move(path));
+        } else {
+            auto dot = name.rfind('.');
+            std::string ext =
+                dot == std::string::npos || dot == 0 ? "" : name.substr(dot);
+            if (!excl.excluded_file(rel, name, ext))
+                me.files.push_back(std::move(path));
+        }
+    }
+}
+
+std::vector<std::string> walk_tree(const fs::path &root,
+                                   const ExclusionMatcher &excl) {
+    unsigned n_workers = std::thread::hardware_concurrency();
+    n_workers = std::clamp(n_workers, 1u, 8u);
+
+    std::vector<std::unique_ptr<WalkWorker>> workers;
+    for (unsigned i = 0; i < n_workers; i++)
+        workers.push_back(std::make_unique<WalkWorker>());
+
+    uint64_t walk_start = now_ns();
+    // directories queued but not yet listed; the walk is over at zero
+    std::atomic<long> pending{1};
+    // idle workers sleep here until new directories are queued
+    std::mutex idle_lock;
+    std::condition_variable idle_cv;
+    std::string root_str = root.string();
+    while (root_str.size() > 1 && root_str.back() == '/')
+        root_str.pop_back();
+    workers[0]->dirs.push_back(root_str);
+    size_t root_len = root_str.size() + (root_str.back() == '/' ? 0 : 1);
+
+    auto take = [&](unsigned self, std::string &dir) {
+        {
+            std::lock_guard<std::mutex> l(workers[self]->lock);
+            if (!workers[self]->dirs.empty()) {
+                dir = std::move(workers[self]->dirs.back());
+                workers[self]->dirs.pop_back();
+                return true;
+            }
+        }
+        for (unsigned k = 1; k < n_workers; k++) {
+            WalkWorker &victim = *workers[(self + k) % n_workers];
+            std::lock_guard<std::mutex> l(victim.lock);
+            if (!victim.dirs.empty()) {
+                dir = std::move(victim.dirs.front());
+                victim.dirs.pop_front();
+                return true;
+            }
+        }
+        return false;
+    };
+
+    auto run = [&](unsigned self) {
+        WalkWorker &me = *workers[self];
+        std::vector<std::string> subdirs;
+        std::string dir;
+        while (pending.load() > 0) {
+            if (!take(self, dir)) {
+                std::unique_lock<std::mutex> l(idle_lock);
+                idle_cv.wait_for(l, std::chrono::milliseconds(1));
+                continue;
+            }
+            subdirs.clear();
+            walk_dir(dir, root_len, excl, me, subdirs);
+            if (!subdirs.empty()) {
+                pending.fetch_add(static_cast<long>(subdirs.size()));
+                std::lock_guard<std::mutex> l(me.lock);
+                for (auto &s : subdirs)
+                    me.dirs.push_back(std::move(s));
+            }
+            if (pending.fetch_sub(1) == 1 || !subdirs.empty())
+                idle_cv.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < n_workers; i++)
+        threads.emplace_back(run, i);
+    run(0);
+    for (auto &t : threads)
+        t.join();
+
+    std::vector<std::string> files;
+    std::unordered_map<std::string, DirListing> snapshot;
+    size_t reused = 0;
+    for (auto &w : workers) {
+        files.insert(files.end(), std::make_move_iterator(w->files.begin()),
+                     std::make_move_iterator(w->files.end()));
+        for (auto &[dir, listing] : w->listings)
+            snapshot.emplace(std::move(dir), std::move(listing));
+        reused += w->reused;
+    }
+    std::sort(files.begin(), files.end());
+
+    Logger::debug("walked " + std::to_string(snapshot.size()) +
+                  " directories, " + std::to_string(reused) +
+                  " listings reused from the snapshot");
+    // a snapshot that was reused entirely is already on disk
+    if (reused != snapshot.size() || snapshot.size() != dir_snapshot.size()) {
+        dir_snapshot = std::move(snapshot);
+        dir_snapshot_time = walk_start;
+        dir_snapshot_dirty = true;
+    }
+    return files;
+}
+#else
+std::vector<std::string> walk_tree(const fs::path &root,
+                                   const ExclusionMatcher &excl) {
+    std::vector<std::string> files;
+    for (auto it = fs::recursive_directory_iterator(root);
+         it != fs::recursive_directory_iterator(); ++it) {
+        std::string rel = it->path().lexically_relative(root).string();
+        std::string name = it->path().filename().string();
+        if (it->is_directory()) {
+            if (excl.excluded_dir(rel, name))
+                it.disable_recursion_pending();
+        } else if (it->is_regular_file() &&
+                   !excl.excluded_file(rel, name,
+                                       it->path().extension().string())) {
+            files.push_back(it->path().string());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+#endif
+#endif